@@ -27,41 +27,32 @@ namespace pacman
     * @brief Processes keyboard input for player-controlled entities and sets movement intentions.
     */
     void PacMan::InputSystem() {
-        Mask required = MaskBuilder()
-                .set<Input>()
-                .set<Intent>()
-                .set<PlayerControlled>()
-                .build();
-
         SDL_PumpEvents();
         const bool* keys = SDL_GetKeyboardState(nullptr);
-        for (id_type id = 0; id <= World::maxId().id; ++id) {
-            ent_type e{id};
-            if (World::mask(e).test(required)) {
-                const auto& k = World::getComponent<Input>(e);
-                auto& in = World::getComponent<Intent>(e);
-                if (keys[k.up] && !in.blockedUp) {
-                    in.up = true;
-                    in.down = in.left = in.right = false;
-                    in.blockedUp = in.blockedDown = in.blockedLeft = in.blockedRight = false;
-                }
-                else if (keys[k.down] && !in.blockedDown) {
-                    in.down = true;
-                    in.up = in.left = in.right = false;
-                    in.blockedUp = in.blockedDown = in.blockedLeft = in.blockedRight = false;
-                }
-                else if (keys[k.left] && !in.blockedLeft) {
-                    in.left = true;
-                    in.up = in.down = in.right = false;
-                    in.blockedUp = in.blockedDown = in.blockedLeft = in.blockedRight = false;
-                }
-                else if (keys[k.right] && !in.blockedRight) {
-                    in.right = true;
-                    in.up = in.down = in.left = false;
-                    in.blockedUp = in.blockedDown = in.blockedLeft = in.blockedRight = false;
-                }
+        World::view<Input, Intent, PlayerControlled>().each([keys](ent_type e) {
+            const auto& k = World::getComponent<Input>(e);
+            auto& in = World::getComponent<Intent>(e);
+            if (keys[k.up] && !in.blockedUp) {
+                in.up = true;
+                in.down = in.left = in.right = false;
+                in.blockedUp = in.blockedDown = in.blockedLeft = in.blockedRight = false;
             }
-        }
+            else if (keys[k.down] && !in.blockedDown) {
+                in.down = true;
+                in.up = in.left = in.right = false;
+                in.blockedUp = in.blockedDown = in.blockedLeft = in.blockedRight = false;
+            }
+            else if (keys[k.left] && !in.blockedLeft) {
+                in.left = true;
+                in.up = in.down = in.right = false;
+                in.blockedUp = in.blockedDown = in.blockedLeft = in.blockedRight = false;
+            }
+            else if (keys[k.right] && !in.blockedRight) {
+                in.right = true;
+                in.up = in.down = in.left = false;
+                in.blockedUp = in.blockedDown = in.blockedLeft = in.blockedRight = false;
+            }
+        });
     }
 
     /**
@@ -69,85 +60,70 @@ namespace pacman
      */
     void PacMan::MovementSystem()
     {
-        static const Mask mask = MaskBuilder()
-            .set<Intent>()
-            .set<Collider>()
-            .set<Position>()
-            .build();
-
-        for (ent_type e{0}; e.id <= World::maxId().id; ++e.id) {
-            if (World::mask(e).test(mask)) {
-                auto& i = World::getComponent<Intent>(e);
-                const auto& c = World::getComponent<Collider>(e);
-                bool isPlayer = World::mask(e).test(Component<PlayerControlled>::Bit);
-                bool isGhost = World::mask(e).test(Component<Ghost>::Bit);
-
-                const float y = i.up ? -20 : i.down ? 20 : 0;
-                const float x = i.left ? -20 : i.right ? 20 : 0;
-
-                b2Body_SetLinearVelocity(c.b, {x,y});
-                if (isPlayer) {
-                    if (i.up) {
-                        b2Body_SetTransform(c.b, b2Body_GetPosition(c.b), {0.0f, -1.0f});
-                        i.blockedDown = i.blockedLeft = i.blockedRight = false;
-                    }else if (i.down) {
-                        b2Body_SetTransform(c.b, b2Body_GetPosition(c.b), {0.0f, 1.0f});
-                        i.blockedUp = i.blockedLeft = i.blockedRight = false;
-                    } else if (i.left) {
-                        b2Body_SetTransform(c.b, b2Body_GetPosition(c.b), {-1.0f, 0.0f});
-                        i.blockedUp = i.blockedDown = i.blockedRight = false;
-                    }else if (i.right) {
-                        b2Body_SetTransform(c.b, b2Body_GetPosition(c.b), {1.0f, 0.0f});
-                        i.blockedUp = i.blockedDown = i.blockedLeft = false;
-                    }
+        World::view<Intent, Collider, Position>().each([](ent_type e) {
+            auto& i = World::getComponent<Intent>(e);
+            const auto& c = World::getComponent<Collider>(e);
+            bool isPlayer = World::mask(e).test(Component<PlayerControlled>::Bit);
+            bool isGhost = World::mask(e).test(Component<Ghost>::Bit);
+
+            const float y = i.up ? -20 : i.down ? 20 : 0;
+            const float x = i.left ? -20 : i.right ? 20 : 0;
+
+            b2Body_SetLinearVelocity(c.b, {x,y});
+            if (isPlayer) {
+                if (i.up) {
+                    b2Body_SetTransform(c.b, b2Body_GetPosition(c.b), {0.0f, -1.0f});
+                    i.blockedDown = i.blockedLeft = i.blockedRight = false;
+                }else if (i.down) {
+                    b2Body_SetTransform(c.b, b2Body_GetPosition(c.b), {0.0f, 1.0f});
+                    i.blockedUp = i.blockedLeft = i.blockedRight = false;
+                } else if (i.left) {
+                    b2Body_SetTransform(c.b, b2Body_GetPosition(c.b), {-1.0f, 0.0f});
+                    i.blockedUp = i.blockedDown = i.blockedRight = false;
+                }else if (i.right) {
+                    b2Body_SetTransform(c.b, b2Body_GetPosition(c.b), {1.0f, 0.0f});
+                    i.blockedUp = i.blockedDown = i.blockedLeft = false;
                 }
             }
-        }
+        });
     }
 
     /**
      * @brief Renders all drawable entities with textures and positions.
      */
     void PacMan::RenderSystem() {
-        static const Mask mask = MaskBuilder()
-                .set<Position>()
-                .set<Drawable>()
-                .build();
-
         SDL_RenderClear(ren);
-        for (ent_type e{0}; e.id <= World::maxId().id; ++e.id) {
-            if (World::mask(e).test(mask)) {
-                const auto& t = World::getComponent<Position>(e);
-                auto& d = World::getComponent<Drawable>(e);
-                bool pacman = World::mask(e).test(Component<PlayerControlled>::Bit);
-                bool ghost = World::mask(e).test(Component<Ghost>::Bit);
-
-                if (pacman || ghost) {
-                    d.frame++;
-                    if (d.frame == 100)
-                        d.frame = 0;
-                    if (pacman) {
-                        auto& stat = World::getComponent<PlayerStats>(e);
-                        for (int i = 0 ; i < stat.lives; ++i) {
-                            float space = 5.f + (float) i*CLOSE_PACMAN.w;
-                            SDL_FRect lives = {(space)*CHARACTER_TEX_SCALE, (BOARD.h + 4.f) * CHARACTER_TEX_SCALE, CLOSE_PACMAN.w*CHARACTER_TEX_SCALE, CLOSE_PACMAN.h*CHARACTER_TEX_SCALE};
-                            SDL_RenderTextureRotated(
-                                ren, tex, &CLOSE_PACMAN, &lives, 0,
-                                nullptr, SDL_FLIP_NONE);
-                        }
+        World::view<Position, Drawable>().each([this](ent_type e) {
+            const auto& t = World::getComponent<Position>(e);
+            auto& d = World::getComponent<Drawable>(e);
+            bool pacman = World::mask(e).test(Component<PlayerControlled>::Bit);
+            bool ghost = World::mask(e).test(Component<Ghost>::Bit);
+
+            if (pacman || ghost) {
+                d.frame++;
+                if (d.frame == 100)
+                    d.frame = 0;
+                if (pacman) {
+                    auto& stat = World::getComponent<PlayerStats>(e);
+                    for (int i = 0 ; i < stat.lives; ++i) {
+                        float space = 5.f + (float) i*CLOSE_PACMAN.w;
+                        SDL_FRect lives = {(space)*CHARACTER_TEX_SCALE, (BOARD.h + 4.f) * CHARACTER_TEX_SCALE, CLOSE_PACMAN.w*CHARACTER_TEX_SCALE, CLOSE_PACMAN.h*CHARACTER_TEX_SCALE};
+                        SDL_RenderTextureRotated(
+                            ren, tex, &CLOSE_PACMAN, &lives, 0,
+                            nullptr, SDL_FLIP_NONE);
                     }
                 }
-                const SDL_FRect dst = {
-                    t.p.x-d.size.x/2,
-                    t.p.y-d.size.y/2,
-                    d.size.x, d.size.y};
+            }
+            const SDL_FRect dst = {
+                t.p.x-d.size.x/2,
+                t.p.y-d.size.y/2,
+                d.size.x, d.size.y};
 
 
-                SDL_RenderTextureRotated(
-                    ren, tex, &d.part[(d.frame / 10) % 2], &dst, t.a,
-                    nullptr, SDL_FLIP_NONE);
-            }
-        }
+            SDL_RenderTextureRotated(
+                ren, tex, &d.part[(d.frame / 10) % 2], &dst, t.a,
+                nullptr, SDL_FLIP_NONE);
+        });
         SDL_RenderPresent(ren);
     }
 
@@ -156,22 +132,16 @@ namespace pacman
     */
     void PacMan::box_system()
     {
-        static const Mask mask = MaskBuilder()
-            .set<Collider>()
-            .set<Position>()
-            .build();
         static constexpr float	BOX2D_STEP = 1.f/FPS;
         b2World_Step(boxWorld, BOX2D_STEP, 4);
 
-        for (ent_type e{0}; e.id <= World::maxId().id; ++e.id) {
-            if (World::mask(e).test(mask)) {
-                b2Transform t = b2Body_GetTransform(World::getComponent<Collider>(e).b);
-                World::getComponent<Position>(e) = {
-                    {t.p.x*BOX_SCALE, t.p.y*BOX_SCALE},
-                    RAD_TO_DEG * b2Rot_GetAngle(t.q)
-                };
-            }
-        }
+        World::view<Collider, Position>().each([](ent_type e) {
+            b2Transform t = b2Body_GetTransform(World::getComponent<Collider>(e).b);
+            World::getComponent<Position>(e) = {
+                {t.p.x*BOX_SCALE, t.p.y*BOX_SCALE},
+                RAD_TO_DEG * b2Rot_GetAngle(t.q)
+            };
+        });
     }
 
     /**
@@ -183,23 +153,23 @@ namespace pacman
         for (int i = 0; i < se.beginCount; ++i) {
             b2BodyId sensor = b2Shape_GetBody(se.beginEvents[i].sensorShapeId);
             b2BodyId b = b2Shape_GetBody(se.beginEvents[i].visitorShapeId);
-            auto *e = static_cast<ent_type*>(b2Body_GetUserData(b));
-            auto *e1 = static_cast<ent_type*>(b2Body_GetUserData(sensor));
+            const ent_type e = fromUserData(b2Body_GetUserData(b));
+            const ent_type e1 = fromUserData(b2Body_GetUserData(sensor));
 
-            bool sensorIsPlayer = World::mask(*e1).test(Component<PlayerControlled>::Bit);
-            bool sensorIsWall = World::mask(*e1).test(Component<Wall>::Bit);
+            bool sensorIsPlayer = World::mask(e1).test(Component<PlayerControlled>::Bit);
+            bool sensorIsWall = World::mask(e1).test(Component<Wall>::Bit);
 
-            bool isPlayer = World::mask(*e).test(Component<PlayerControlled>::Bit);
-            bool isGhost = World::mask(*e).test(Component<Ghost>::Bit);
-            bool isPellet = World::mask(*e).test(Component<Pellet>::Bit);
-            bool isWall = World::mask(*e).test(Component<Wall>::Bit);
+            bool isPlayer = World::mask(e).test(Component<PlayerControlled>::Bit);
+            bool isGhost = World::mask(e).test(Component<Ghost>::Bit);
+            bool isPellet = World::mask(e).test(Component<Pellet>::Bit);
+            bool isWall = World::mask(e).test(Component<Wall>::Bit);
 
             if (isWall && sensorIsWall) {
                 continue;
             }
             if (sensorIsWall || (isWall && sensorIsPlayer)) {
                 //pacman or ghost hit wall
-                ent_type player = sensorIsPlayer ? *e1 : *e;
+                ent_type player = sensorIsPlayer ? e1 : e;
                 auto& dir = World::getComponent<Intent>(player);
                 const auto& col = World::getComponent<Collider>(player);
                 auto& dGhost = World::getComponent<Drawable>(player);
@@ -257,7 +227,7 @@ namespace pacman
 
             if (sensorIsPlayer && isGhost) {
                 //pacman hit ghost
-                auto& stats = World::getComponent<PlayerStats>(*e1);
+                auto& stats = World::getComponent<PlayerStats>(e1);
                 int lives = stats.lives -1 ;
                 if (lives == 0) {
                     //GAME-OVER
@@ -265,11 +235,11 @@ namespace pacman
                     return;
 
                 }
-                auto& dGhost = World::getComponent<Drawable>(*e);
+                auto& dGhost = World::getComponent<Drawable>(e);
 
                 createGhost(dGhost.part[0], dGhost.part[1], {100.f*CHARACTER_TEX_SCALE, 120.f*CHARACTER_TEX_SCALE});
-                World::destroyEntity(*e1);
-                World::destroyEntity(*e);
+                World::destroyEntity(e1);
+                World::destroyEntity(e);
                 b2DestroyBody(sensor);
                 b2DestroyBody(b);
                 createPacMan(lives);
@@ -279,8 +249,8 @@ namespace pacman
 
             if (sensorIsPlayer && isPellet) {
                 //pacman ate pellet
-                auto& stats = World::getComponent<PlayerStats>(*e1);
-                const auto& pelletData = World::getComponent<Pellet>(*e);
+                auto& stats = World::getComponent<PlayerStats>(e1);
+                const auto& pelletData = World::getComponent<Pellet>(e);
 
                 if (pelletData.type == ePelletState::Normal) {
                     stats.score += 10;
@@ -288,7 +258,7 @@ namespace pacman
                     stats.score += 50;
                     // TODO: Set ghosts to vulnerable state (if implemented)
                 }
-                World::destroyEntity(*e);
+                World::destroyEntity(e);
                 b2DestroyBody(b);
 
             }
@@ -299,29 +269,20 @@ namespace pacman
    * @brief Handles ghost AI behavior such as random movement decisions.
    */
     void PacMan::AISystem() {
-        Mask required = MaskBuilder()
-        .set<Ghost>()
-        .set<Intent>()
-        .set<Drawable>()
-        .build();
-
-        for (id_type id = 0; id <= World::maxId().id; ++id) {
-            ent_type e{id};
-            if (World::mask(e).test(required)) {
-                auto& in = World::getComponent<Intent>(e);
-                auto& dr = World::getComponent<Drawable>(e);
-                if (dr.frame % 240 == 0) {
-                    in.up = in.down = in.left = in.right = false;
-                    int dir = rand() % 4;
-                    switch (dir) {
-                        case 0: in.up = true; break;
-                        case 1: in.down = true; break;
-                        case 2: in.left = true; break;
-                        case 3: in.right = true; break;
-                    }
+        World::view<Ghost, Intent, Drawable>().each([](ent_type e) {
+            auto& in = World::getComponent<Intent>(e);
+            auto& dr = World::getComponent<Drawable>(e);
+            if (dr.frame % 240 == 0) {
+                in.up = in.down = in.left = in.right = false;
+                int dir = rand() % 4;
+                switch (dir) {
+                    case 0: in.up = true; break;
+                    case 1: in.down = true; break;
+                    case 2: in.left = true; break;
+                    case 3: in.right = true; break;
                 }
             }
-        }
+        });
     }
 
     /**
@@ -334,9 +295,10 @@ namespace pacman
         Mask required = MaskBuilder()
             .set<Collider>()
             .build();
-        for (id_type id = 0; id <= World::maxId().id; ++id) {
-            ent_type e{id};
-            if (! World::mask(e).test(notRequired) && World::mask(e).test(required)) {
+        std::vector<ent_type> ents;
+        World::match(required, ents);
+        for (ent_type e : ents) {
+            if (! World::mask(e).test(notRequired)) {
                 auto& c = World::getComponent<Collider>(e);
                 World::destroyEntity(e);
                 b2DestroyBody(c.b);
@@ -376,7 +338,7 @@ namespace pacman
          PlayerControlled{},
          PlayerStats{0,lives}
          );
-        b2Body_SetUserData(pacmanBody, new ent_type{e.entity()});
+        b2Body_SetUserData(pacmanBody, toUserData(e.entity()));
     }
 
     /**
@@ -408,7 +370,7 @@ namespace pacman
             Intent{},
             Ghost{}
         );
-        b2Body_SetUserData(padBody, new ent_type{e.entity()});
+        b2Body_SetUserData(padBody, toUserData(e.entity()));
     }
 
     /**
@@ -439,7 +401,7 @@ namespace pacman
             Collider{pelletBody},
             Pellet{ePelletState::Normal}
         );
-        b2Body_SetUserData(pelletBody, new ent_type{e.entity()});
+        b2Body_SetUserData(pelletBody, toUserData(e.entity()));
     }
 
     /**
@@ -474,7 +436,7 @@ namespace pacman
                 Collider{wallBody},
                 Wall{shape, {width, height}}
         );
-        b2Body_SetUserData(wallBody, new ent_type{e.entity()});
+        b2Body_SetUserData(wallBody, toUserData(e.entity()));
     }
 
     /**
@@ -528,6 +490,10 @@ namespace pacman
     {
         b2WorldDef worldDef = b2DefaultWorldDef();
         worldDef.gravity = {0,0};
+        worldDef.workerCount = boxTasks.workers();
+        worldDef.enqueueTask = TaskSystem::enqueueTask;
+        worldDef.finishTask = TaskSystem::finishTask;
+        worldDef.userTaskContext = &boxTasks;
         boxWorld = b2CreateWorld(&worldDef);
     }
 
@@ -774,6 +740,7 @@ namespace pacman
             box_system();
             CollisionSystem();
             RenderSystem();
+            World::step();
 
             auto end = SDL_GetTicks();
             if (end-start < GAME_FRAME) {
@@ -190,6 +190,8 @@ namespace pacman{
         SDL_Window* win;
 
         b2WorldId boxWorld = b2_nullWorldId;
+        /// @brief Runs Box2D's solver tasks across all cores.
+        TaskSystem boxTasks;
 
     };
 } // namespace PacMan
@@ -1,13 +1,39 @@
 // Copyright (C) 2025 Moshe Sulamy
 
 #pragma once
+#include <cassert>
 #include <cstdint>
+#include <cstdlib>
 #include <cstring>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <tuple>
 #include <type_traits>
+#include <vector>
+#include <new>
+#if defined(__SSE2__)
+	#include <immintrin.h>
+#endif
+#if defined(_WIN32)
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+	#include <unistd.h>
+#endif
 
 namespace bagel
 {
+	// backing memory for DynamicBag; see HeapAllocator and friends
+	enum class Allocator { Heap, Arena, Virtual, Pool };
+
 	struct Bagel
 	{
 		bool	AggregateUpdates = true;
@@ -17,23 +43,68 @@ namespace bagel
 		int		InitialEntities = 3000;
 		int		InitialPackedSize = 1000;
 		int		MaxComponents = 1000;
+		int		MaxViews = 64;
+		int		GenerationBits = 8;
+
+		Allocator		BagAllocator = Allocator::Heap;
+		std::size_t		ArenaBlockBytes = std::size_t{1} << 22;
+		std::size_t		ReserveBytes = std::size_t{1} << 32;
+		std::size_t		PoolBytes = std::size_t{1} << 26;
 	};
 
 	template <class T> struct Storage;
 	template <class T> class PackedStorage;
 	template <class T> class SparseStorage;
 	template <class T> class TaggedStorage;
+	template <class T> class SoAStorage;
 
-#if __has_include("bagel_cfg.h")
+#ifndef BAGEL_CFG
+	#define BAGEL_CFG "bagel_cfg.h"
+#endif
+#if __has_include(BAGEL_CFG)
 	#define BAGEL_STORAGE(C,T) template <> struct Storage<C> { using type = T<C>; };
-	#include "bagel_cfg.h"
+	#include BAGEL_CFG
 	#undef BAGEL_STORAGE
 #else
 	constexpr Bagel Params{};
 #endif
 
+#ifndef BAGEL_ASSERT
+	#define BAGEL_ASSERT(x) assert(x)
+#endif
+
+// defined for every TU, gives each thread its own independent World and storages.
+// Needs a DynamicResize config; only bagel_bench_worlds builds this way. The games do
+// not: their configs use static bags and DaveGame keeps process-wide static state
+#if defined(BAGEL_THREAD_LOCAL_WORLD)
+	#define BAGEL_WORLD_LOCAL thread_local
+	constexpr inline bool ThreadLocalWorld = true;
+	static_assert(Params.DynamicResize, "thread-local worlds keep static bags in TLS; use DynamicResize");
+#else
+	#define BAGEL_WORLD_LOCAL
+	constexpr inline bool ThreadLocalWorld = false;
+#endif
+
 	using id_type = int;
-	struct ent_type { id_type id; };
+	// id indexes the world; gen tells a live handle from a stale copy of a recycled id
+	struct ent_type {
+		id_type			id	: 32 - Params.GenerationBits;
+		std::uint32_t	gen	: Params.GenerationBits;
+	};
+	static_assert(sizeof(ent_type) == sizeof(id_type));
+	constexpr bool operator==(ent_type a, ent_type b) { return a.id == b.id && a.gen == b.gen; }
+	// the handle itself as a void*, for C APIs (Box2D, SDL) that carry user data; nothing to allocate or free
+	inline void* toUserData(ent_type e) {
+		std::uint32_t bits;
+		std::memcpy(&bits, &e, sizeof(bits));
+		return reinterpret_cast<void*>(static_cast<std::uintptr_t>(bits));
+	}
+	inline ent_type fromUserData(const void* p) {
+		const auto bits = static_cast<std::uint32_t>(reinterpret_cast<std::uintptr_t>(p));
+		ent_type e;
+		std::memcpy(&e, &bits, sizeof(e));
+		return e;
+	}
 	using size_type = int;
 	using index_type = int;
 	using mask_type =
@@ -50,25 +121,195 @@ namespace bagel
 		void operator=(const NoCopy&) = delete;
 	};
 
-	template <class T, int N>
+	// malloc/realloc; growing may move the block
+	struct HeapAllocator final : NoInstance
+	{
+		static constexpr bool InPlace = false;
+		static void* allocate(std::size_t n) { return malloc(n); }
+		static void* reallocate(void* p, std::size_t, std::size_t to) { return realloc(p, to); }
+		static void release(void* p, std::size_t) { free(p); }
+	};
+
+	// monotonic: bumps through blocks of ArenaBlockBytes and never frees; the
+	// most recent allocation grows in place while its block has room
+	class ArenaAllocator final : NoInstance
+	{
+	public:
+		static constexpr bool InPlace = false;
+		static void* allocate(std::size_t n) {
+			n = align(n);
+			if (_used + n > _cap) {
+				_cap = std::max(n, Params.ArenaBlockBytes);
+				_block = static_cast<char*>(std::aligned_alloc(Align, _cap));
+				_used = 0;
+			}
+			_last = _block + _used;
+			_used += n;
+			return _last;
+		}
+		static void* reallocate(void* p, std::size_t from, std::size_t to) {
+			if (p == _last && _last + align(to) <= _block + _cap) {
+				_used = (_last - _block) + align(to);
+				return p;
+			}
+			void* q = allocate(to);
+			memcpy(q, p, from);
+			return q;
+		}
+		static void release(void*, std::size_t) {}
+	private:
+		static constexpr std::size_t Align = 64;
+		static std::size_t align(std::size_t n) { return (n + Align - 1) & ~(Align - 1); }
+
+		static inline BAGEL_WORLD_LOCAL char*			_block = nullptr;
+		static inline BAGEL_WORLD_LOCAL char*			_last = nullptr;
+		static inline BAGEL_WORLD_LOCAL std::size_t	_used = 0;
+		static inline BAGEL_WORLD_LOCAL std::size_t	_cap = 0;
+	};
+
+	// reserves ReserveBytes of address space per block up front (huge-page
+	// aligned where possible) and commits pages as it grows; never moves
+	class VirtualAllocator final : NoInstance
+	{
+	public:
+		static constexpr bool InPlace = true;
+		static void* allocate(std::size_t n) {
+#if defined(_WIN32)
+			void* p = VirtualAlloc(nullptr, Params.ReserveBytes, MEM_RESERVE, PAGE_NOACCESS);
+#else
+			const std::size_t huge = std::size_t{2} << 20;
+			char* raw = static_cast<char*>(mmap(nullptr, Params.ReserveBytes + huge, PROT_NONE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0));
+			BAGEL_ASSERT(raw != MAP_FAILED);
+			char* p = reinterpret_cast<char*>((reinterpret_cast<std::uintptr_t>(raw) + huge - 1) & ~(huge - 1));
+			if (p != raw)
+				munmap(raw, p - raw);
+			munmap(p + Params.ReserveBytes, raw + huge - p);
+	#if defined(MADV_HUGEPAGE)
+			madvise(p, Params.ReserveBytes, MADV_HUGEPAGE);
+	#endif
+#endif
+			commit(p, 0, n);
+			return p;
+		}
+		static void* reallocate(void* p, std::size_t from, std::size_t to) {
+			commit(p, from, to);
+			return p;
+		}
+		static void release(void* p, std::size_t) {
+#if defined(_WIN32)
+			VirtualFree(p, 0, MEM_RELEASE);
+#else
+			munmap(p, Params.ReserveBytes);
+#endif
+		}
+	private:
+		static void commit(void* p, std::size_t from, std::size_t to) {
+			BAGEL_ASSERT(to <= Params.ReserveBytes);
+			from = pageAlign(from);
+			to = pageAlign(to);
+			if (to <= from)
+				return;
+			char* at = static_cast<char*>(p) + from;
+#if defined(_WIN32)
+			VirtualAlloc(at, to - from, MEM_COMMIT, PAGE_READWRITE);
+#else
+			mprotect(at, to - from, PROT_READ | PROT_WRITE);
+#endif
+		}
+		static std::size_t pageAlign(std::size_t n) {
+			static const std::size_t page = [] {
+#if defined(_WIN32)
+				SYSTEM_INFO info;
+				GetSystemInfo(&info);
+				return static_cast<std::size_t>(info.dwPageSize);
+#else
+				return static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+#endif
+			}();
+			return (n + page - 1) / page * page;
+		}
+	};
+
+	// bounded: power-of-two blocks carved from one PoolBytes buffer and
+	// recycled through per-size free lists; running out is an error
+	class PoolAllocator final : NoInstance
+	{
+	public:
+		static constexpr bool InPlace = false;
+		static void* allocate(std::size_t n) {
+			const int c = sizeClass(n);
+			if (void* p = _free[c]) {
+				_free[c] = *static_cast<void**>(p);
+				return p;
+			}
+			const std::size_t bytes = std::size_t{1} << c;
+			BAGEL_ASSERT(_used + bytes <= Params.PoolBytes && "bagel pool exhausted");
+			if (_used + bytes > Params.PoolBytes)
+				return nullptr;
+			void* p = buffer() + _used;
+			_used += bytes;
+			return p;
+		}
+		static void* reallocate(void* p, std::size_t from, std::size_t to) {
+			if (sizeClass(from) == sizeClass(to))
+				return p;
+			void* q = allocate(to);
+			memcpy(q, p, std::min(from, to));
+			release(p, from);
+			return q;
+		}
+		static void release(void* p, std::size_t n) {
+			const int c = sizeClass(n);
+			*static_cast<void**>(p) = _free[c];
+			_free[c] = p;
+		}
+	private:
+		static constexpr int MinClass = 6;
+		static int sizeClass(std::size_t n) {
+			return n <= (std::size_t{1} << MinClass) ? MinClass : 64 - __builtin_clzll(n - 1);
+		}
+		static char* buffer() {
+			static BAGEL_WORLD_LOCAL char* const buf = static_cast<char*>(std::aligned_alloc(std::size_t{1} << MinClass, Params.PoolBytes));
+			return buf;
+		}
+
+		static inline BAGEL_WORLD_LOCAL void*			_free[64] = {};
+		static inline BAGEL_WORLD_LOCAL std::size_t	_used = 0;
+	};
+
+	using BagAllocator =
+		std::conditional_t<Params.BagAllocator == Allocator::Arena, ArenaAllocator,
+		std::conditional_t<Params.BagAllocator == Allocator::Virtual, VirtualAllocator,
+		std::conditional_t<Params.BagAllocator == Allocator::Pool, PoolAllocator,
+			HeapAllocator>>>;
+
+	// trivially copyable T lives in raw memory; any other T keeps every slot
+	// up to capacity constructed, so indexing past size() is always safe
+	template <class T, int N, class A = BagAllocator>
 	class DynamicBag : NoCopy
 	{
 	public:
+		DynamicBag() {
+			_arr = static_cast<T*>(A::allocate(sizeof(T) * N));
+			construct(0, N);
+		}
+		~DynamicBag() {
+			if constexpr (!Raw)
+				for (index_type i = 0; i < _capacity; ++i)
+					_arr[i].~T();
+			A::release(_arr, sizeof(T) * _capacity);
+		}
+
 		void push(const T& t) {
-			if (_size == _capacity) {
-				_capacity *= 2;
-				_arr = static_cast<T*>(
-					realloc(_arr, sizeof(T)*_capacity));
-			}
+			if (_size == _capacity)
+				grow(_capacity*2);
 			_arr[_size] = t;
 			++_size;
 		}
 		void ensure(size_type s) {
-			if (_capacity < s) {
-				_capacity = std::max(s, _capacity*2);
-				_arr = static_cast<T*>(
-					realloc(_arr, sizeof(T)*_capacity));
-			}
+			if (_capacity < s)
+				grow(std::max(s, _capacity*2));
 		}
 		T pop() { return _arr[--_size]; }
 		T& operator[](index_type i) { return _arr[i]; }
@@ -77,10 +318,31 @@ namespace bagel
 
 		size_type size() const { return _size; }
 		size_type capacity() const { return _capacity; }
-
-		~DynamicBag() { free(_arr); }
 	private:
-		T*			_arr = static_cast<T*>(malloc(sizeof(T) * N));
+		static constexpr bool Raw = std::is_trivially_copyable_v<T>;
+
+		void grow(size_type capacity) {
+			if constexpr (Raw || A::InPlace) {
+				_arr = static_cast<T*>(A::reallocate(_arr, sizeof(T) * _capacity, sizeof(T) * capacity));
+			} else {
+				T* arr = static_cast<T*>(A::allocate(sizeof(T) * capacity));
+				for (index_type i = 0; i < _capacity; ++i) {
+					new (arr + i) T(std::move(_arr[i]));
+					_arr[i].~T();
+				}
+				A::release(_arr, sizeof(T) * _capacity);
+				_arr = arr;
+			}
+			construct(_capacity, capacity);
+			_capacity = capacity;
+		}
+		void construct(index_type from, index_type to) {
+			if constexpr (!Raw)
+				for (index_type i = from; i < to; ++i)
+					new (_arr + i) T();
+		}
+
+		T*			_arr;
 		size_type	_size = 0;
 		size_type	_capacity = N;
 	};
@@ -104,6 +366,206 @@ namespace bagel
 	template <class T, int N>
 	using Bag = std::conditional_t<Params.DynamicResize, DynamicBag<T, N>, StaticBag<T,N>>;
 
+	class ThreadPool final : NoCopy
+	{
+	public:
+		explicit ThreadPool(int workers) {
+			for (int i = 0; i < workers; ++i)
+				_threads.emplace_back([this] { work(); });
+		}
+		~ThreadPool() {
+			{
+				std::lock_guard lock(_mutex);
+				_quit = true;
+			}
+			_wake.notify_all();
+			for (auto& t : _threads)
+				t.join();
+		}
+		int workers() const { return static_cast<int>(_threads.size()); }
+
+		// calls f(begin,end) on chunks of [0,n); the calling thread takes part
+		// nested calls (from inside f) run serially on the calling thread
+		template <class F>
+		void parallelFor(index_type n, F&& f, index_type grain = 1024) {
+			if (n <= grain || _threads.empty() || _inside) {
+				if (n > 0) f(0, n);
+				return;
+			}
+			{
+				std::lock_guard lock(_mutex);
+				_job = {&invoke<F>, &f, n, std::max(grain, n / (8 * (workers()+1)))};
+				_next = 0;
+				_open = true;
+				++_generation;
+			}
+			_wake.notify_all();
+			drain(_job);
+
+			std::unique_lock lock(_mutex);
+			_open = false;
+			_done.wait(lock, [this] { return _active == 0; });
+		}
+
+		static ThreadPool& global() {
+			static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+			return pool;
+		}
+	private:
+		struct Job {
+			void		(*fn)(void*, index_type, index_type) = nullptr;
+			void*		ctx = nullptr;
+			index_type	n = 0;
+			index_type	grain = 1;
+		};
+		template <class F>
+		static void invoke(void* f, index_type b, index_type e) {
+			(*static_cast<std::remove_reference_t<F>*>(f))(b, e);
+		}
+
+		void drain(const Job& job) {
+			_inside = true;
+			for (index_type b; (b = _next.fetch_add(job.grain)) < job.n;)
+				job.fn(job.ctx, b, std::min(b + job.grain, job.n));
+			_inside = false;
+		}
+		void work() {
+			std::uint64_t seen = 0;
+			std::unique_lock lock(_mutex);
+			while (true) {
+				_wake.wait(lock, [&] { return _quit || (_open && _generation != seen); });
+				if (_quit)
+					return;
+				seen = _generation;
+				const Job job = _job;
+				++_active;
+				lock.unlock();
+				drain(job);
+				lock.lock();
+				if (--_active == 0)
+					_done.notify_all();
+			}
+		}
+
+		std::vector<std::thread>	_threads;
+		std::mutex					_mutex;
+		std::condition_variable		_wake;
+		std::condition_variable		_done;
+		Job							_job;
+		std::atomic<index_type>		_next{0};
+		std::uint64_t				_generation = 0;
+		int							_active = 0;
+		bool						_open = false;
+		bool						_quit = false;
+		static inline thread_local bool	_inside = false;
+	};
+
+	// ranged tasks in the shape of Box2D's b2WorldDef task callbacks: idle
+	// threads take ranges from any open task, the thread waiting in finish()
+	// helps with its own. Tasks are enqueued and finished from one thread;
+	// that thread is worker 0
+	class TaskSystem final : NoCopy
+	{
+	public:
+		using TaskFn = void(int begin, int end, std::uint32_t worker, void* ctx);
+
+		// threads counts the calling thread too
+		explicit TaskSystem(int threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()))) {
+			for (int i = 1; i < std::min(threads, MaxWorkers); ++i)
+				_threads.emplace_back([this, i] { work(static_cast<std::uint32_t>(i)); });
+		}
+		~TaskSystem() {
+			{
+				std::lock_guard lock(_mutex);
+				_quit = true;
+			}
+			_wake.notify_all();
+			for (auto& t : _threads)
+				t.join();
+		}
+		int workers() const { return static_cast<int>(_threads.size()) + 1; }
+
+		// nullptr when f already ran inline
+		void* enqueue(TaskFn* f, int count, int minRange, void* ctx) {
+			if (_threads.empty() || count <= minRange) {
+				f(0, count, 0, ctx);
+				return nullptr;
+			}
+			std::unique_lock lock(_mutex);
+			Task* t = std::find_if(std::begin(_tasks), std::end(_tasks), [](const Task& t) { return !t.live; });
+			if (t == std::end(_tasks)) {
+				lock.unlock();
+				f(0, count, 0, ctx);
+				return nullptr;
+			}
+			*t = {f, ctx, count, std::max(minRange, count / (4 * workers())), 0, 0, true};
+			lock.unlock();
+			_wake.notify_all();
+			return t;
+		}
+		void finish(void* task) {
+			Task* t = static_cast<Task*>(task);
+			std::unique_lock lock(_mutex);
+			while (t->next < t->count)
+				runRange(*t, 0, lock);
+			_finished.wait(lock, [t] { return t->done == t->count; });
+			t->live = false;
+		}
+
+		// plug into b2WorldDef::enqueueTask / finishTask with userTaskContext = this
+		static void* enqueueTask(TaskFn* f, int count, int minRange, void* ctx, void* self) {
+			return static_cast<TaskSystem*>(self)->enqueue(f, count, minRange, ctx);
+		}
+		static void finishTask(void* task, void* self) {
+			static_cast<TaskSystem*>(self)->finish(task);
+		}
+	private:
+		static constexpr int MaxWorkers = 64, MaxTasks = 64;
+		struct Task {
+			TaskFn*	f = nullptr;
+			void*	ctx = nullptr;
+			int		count = 0;
+			int		grain = 1;
+			int		next = 0;
+			int		done = 0;
+			bool	live = false;
+		};
+
+		// claims the next range of t and runs it unlocked
+		void runRange(Task& t, std::uint32_t worker, std::unique_lock<std::mutex>& lock) {
+			const int b = t.next, e = std::min(b + t.grain, t.count);
+			t.next = e;
+			lock.unlock();
+			t.f(b, e, worker, t.ctx);
+			lock.lock();
+			if ((t.done += e - b) == t.count)
+				_finished.notify_all();
+		}
+		Task* open() {
+			for (Task& t : _tasks)
+				if (t.live && t.next < t.count)
+					return &t;
+			return nullptr;
+		}
+		void work(std::uint32_t worker) {
+			std::unique_lock lock(_mutex);
+			while (true) {
+				Task* t = nullptr;
+				_wake.wait(lock, [&] { return _quit || (t = open()); });
+				if (_quit)
+					return;
+				runRange(*t, worker, lock);
+			}
+		}
+
+		std::vector<std::thread>	_threads;
+		std::mutex					_mutex;
+		std::condition_variable		_wake;
+		std::condition_variable		_finished;
+		Task						_tasks[MaxTasks];
+		bool						_quit = false;
+	};
+
 	struct StorageCallbacks
 	{
 		using Destroy = void (*)(ent_type);
@@ -116,20 +578,20 @@ namespace bagel
 	{
 	public:
 		static void add(ent_type e, const T& t) {
-			_bag.ensure(e.id);
+			_bag.ensure(e.id+1);
 			_bag[e.id] = t;
 		}
 		static void del(ent_type) {}
 		static T& get(ent_type e) { return _bag[e.id]; }
 	private:
-		static inline Bag<T,Params.InitialEntities> _bag;
+		static inline BAGEL_WORLD_LOCAL Bag<T,Params.InitialEntities> _bag;
 	};
 	template <class T>
 	class PackedStorage final : NoInstance
 	{
 	public:
 		static void add(ent_type e, const T& t) {
-			_entToComp.ensure(e.id);
+			_entToComp.ensure(e.id+1);
 			_entToComp[e.id] = _comps.size();
 			_comps.push(t);
 			_compToEnt.push(e);
@@ -152,10 +614,103 @@ namespace bagel
 		static ent_type entity(index_type idx) {
 			return _compToEnt[idx];
 		}
+
+		template <class F>
+		static void each(F&& f) {
+			for (index_type i = 0; i < _comps.size(); ++i)
+				f(_compToEnt[i], _comps[i]);
+		}
+		template <class F>
+		static void eachParallel(F&& f) {
+			if constexpr (ThreadLocalWorld) {
+				// workers would see their own, empty, storage
+				each(f);
+				return;
+			}
+			ThreadPool::global().parallelFor(_comps.size(), [&](index_type b, index_type e) {
+				for (index_type i = b; i < e; ++i)
+					f(_compToEnt[i], _comps[i]);
+			});
+		}
 	private:
-		static inline Bag<T,Params.InitialPackedSize>			_comps;
-		static inline Bag<index_type,Params.InitialEntities>	_entToComp;
-		static inline Bag<ent_type,Params.InitialPackedSize>	_compToEnt;
+		static inline BAGEL_WORLD_LOCAL Bag<T,Params.InitialPackedSize>			_comps;
+		static inline BAGEL_WORLD_LOCAL Bag<index_type,Params.InitialEntities>	_entToComp;
+		static inline BAGEL_WORLD_LOCAL Bag<ent_type,Params.InitialPackedSize>	_compToEnt;
+
+		static inline StorageCallbacks callbacks{del};
+
+		__attribute__((used))
+		static inline StorageRegister<T> reg{callbacks};
+	};
+	template <auto ...Ms>
+	struct Field {
+		template <class T>
+		static auto& of(T& t) { return (t .* ... .* Ms); }
+	};
+	template <class ...Fs> struct Fields {};
+
+	// specialize with `using type = Fields<Field<&T::a>, Field<&T::p, &P::x>, ...>`
+	template <class T> struct SoALayout;
+
+	template <class T>
+	class SoAStorage final : NoInstance
+	{
+		template <class> struct Columns;
+		template <class ...Fs> struct Columns<Fields<Fs...>> {
+			using type = std::tuple<
+				Bag<std::remove_reference_t<decltype(Fs::of(std::declval<T&>()))>,
+					Params.InitialPackedSize>...>;
+		};
+		using Layout = typename SoALayout<T>::type;
+	public:
+		static constexpr size_type FieldCount = std::tuple_size_v<typename Columns<Layout>::type>;
+
+		static void add(ent_type e, const T& t) {
+			_entToComp.ensure(e.id+1);
+			_entToComp[e.id] = _compToEnt.size();
+			_compToEnt.push(e);
+			forFields([&](auto f, auto& col) { col.push(decltype(f)::of(t)); });
+		}
+		static void del(ent_type e) {
+			index_type ent_comp_idx = _entToComp[e.id];
+			ent_type last_ent = _compToEnt.pop();
+
+			forFields([&](auto, auto& col) { col[ent_comp_idx] = col.pop(); });
+			_compToEnt[ent_comp_idx] = last_ent;
+			_entToComp[last_ent.id] = ent_comp_idx;
+		}
+		// gathers a copy; write back through set()
+		static T get(ent_type e) {
+			T t{};
+			const index_type idx = _entToComp[e.id];
+			forFields([&](auto f, auto& col) { decltype(f)::of(t) = col[idx]; });
+			return t;
+		}
+		static void set(ent_type e, const T& t) {
+			const index_type idx = _entToComp[e.id];
+			forFields([&](auto f, auto& col) { col[idx] = decltype(f)::of(t); });
+		}
+
+		static int size() { return _compToEnt.size(); }
+		static ent_type entity(index_type idx) {
+			return _compToEnt[idx];
+		}
+		// dense array of the I-th field, parallel to entity(idx)
+		template <std::size_t I>
+		static auto* field() { return &std::get<I>(_cols)[0]; }
+	private:
+		template <class Fn, class ...Fs, std::size_t ...I>
+		static void forFields(Fn& fn, Fields<Fs...>, std::index_sequence<I...>) {
+			(fn(Fs{}, std::get<I>(_cols)), ...);
+		}
+		template <class Fn>
+		static void forFields(Fn&& fn) {
+			forFields(fn, Layout{}, std::make_index_sequence<FieldCount>{});
+		}
+
+		static inline BAGEL_WORLD_LOCAL typename Columns<Layout>::type			_cols;
+		static inline BAGEL_WORLD_LOCAL Bag<index_type,Params.InitialEntities>	_entToComp;
+		static inline BAGEL_WORLD_LOCAL Bag<ent_type,Params.InitialPackedSize>	_compToEnt;
 
 		static inline StorageCallbacks callbacks{del};
 
@@ -176,13 +731,40 @@ namespace bagel
 		using type = SparseStorage<T>;
 	};
 
+	// bit j set when (col[j] & q) == q, for j < len <= 64
+	inline std::uint64_t matchColumn(const mask_type* col, index_type len, mask_type q) {
+		std::uint64_t hits = 0;
+		index_type j = 0;
+		if constexpr (sizeof(mask_type) == 8) {
+#if defined(__AVX2__)
+			const __m256i vq = _mm256_set1_epi64x(q);
+			for (; j + 4 <= len; j += 4) {
+				const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(col + j));
+				const __m256i eq = _mm256_cmpeq_epi64(_mm256_and_si256(x, vq), vq);
+				hits |= std::uint64_t(_mm256_movemask_pd(_mm256_castsi256_pd(eq))) << j;
+			}
+#elif defined(__SSE2__)
+			const __m128i vq = _mm_set1_epi64x(q);
+			for (; j + 2 <= len; j += 2) {
+				const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(col + j));
+				const int eq = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(x, vq), vq)));
+				hits |= std::uint64_t(((eq & 0x3) == 0x3) | ((eq & 0xC) == 0xC) << 1) << j;
+			}
+#endif
+		}
+		for (; j < len; ++j)
+			hits |= std::uint64_t((col[j] & q) == q) << j;
+		return hits;
+	}
+
 	class SingleMask final
 	{
 	public:
 		using bit_type = mask_type;
-		static constexpr bit_type bit(index_type idx) { return 1<<idx; }
+		static constexpr bit_type bit(index_type idx) { return mask_type{1}<<idx; }
 
 		void set(const bit_type b) { _mask |= b; }
+		void set(const SingleMask m) { _mask |= m._mask; }
 
 		void clear(const bit_type b) { _mask &= ~b; }
 		void clear() { _mask = 0; }
@@ -190,7 +772,23 @@ namespace bagel
 		bool test(const bit_type b) const { return _mask & b; }
 		bool test(const SingleMask m) const { return (_mask & m._mask) == m._mask; }
 
-		index_type ctz() const { return _mask ? __builtin_ctz(_mask) : -1; }
+		index_type ctz() const { return _mask ? __builtin_ctzll(_mask) : -1; }
+		// f(index) for every set bit, lowest first
+		template <class F>
+		void each(F&& f) const {
+			for (std::uint64_t bits = _mask; bits; bits &= bits - 1)
+				f(static_cast<index_type>(__builtin_ctzll(bits)));
+		}
+
+		// f(i) for every i whose word cols[0][i] holds all of m's bits, in order
+		template <class F>
+		static void match(const mask_type* const* cols, index_type n, const SingleMask m, F&& f) {
+			for (index_type i = 0; i < n; i += 64)
+				for (std::uint64_t hits = matchColumn(cols[0] + i, std::min<index_type>(64, n - i), m._mask); hits; hits &= hits - 1)
+					f(i + __builtin_ctzll(hits));
+		}
+		mask_type word(index_type) const { return _mask; }
+		static constexpr size_type Words = 1;
 	private:
 		mask_type	_mask{0};
 	};
@@ -202,10 +800,14 @@ namespace bagel
 			const mask_type		mask;
 		};
 		static constexpr bit_type bit(index_type idx) {
-			return {idx/BitsetWidth, static_cast<mask_type>(1<<(idx%BitsetWidth))};
+			return {idx/BitsetWidth, static_cast<mask_type>(mask_type{1}<<(idx%BitsetWidth))};
 		}
 
 		void set(const bit_type& b) { _masks[b.index] |= b.mask; }
+		void set(const MultiMask& m) {
+			for (index_type i = 0; i < Size; ++i)
+				_masks[i] |= m._masks[i];
+		}
 
 		void clear(const bit_type& b) { _masks[b.index] &= ~b.mask; }
 		void clear() { memset(_masks, 0, sizeof(_masks)); }
@@ -221,75 +823,204 @@ namespace bagel
 		index_type ctz() const {
 			for (index_type i = 0; i < Size; ++i) {
 				if (_masks[i]) {
-					int c = __builtin_ctz(_masks[i]);
+					int c = __builtin_ctzll(_masks[i]);
 					return c + i*BitsetWidth;
 				}
 			}
 			return -1;
 		}
+		template <class F>
+		void each(F&& f) const {
+			for (index_type i = 0; i < Size; ++i)
+				for (std::uint64_t bits = _masks[i]; bits; bits &= bits - 1)
+					f(static_cast<index_type>(i*BitsetWidth + __builtin_ctzll(bits)));
+		}
+
+		// f(i) for every i whose words cols[w][i] hold all of m's bits, in order;
+		// only the columns m actually uses are read
+		template <class F>
+		static void match(const mask_type* const* cols, index_type n, const MultiMask& m, F&& f) {
+			index_type words[Size], count = 0;
+			for (index_type w = 0; w < Size; ++w)
+				if (m._masks[w])
+					words[count++] = w;
+			for (index_type i = 0; i < n; i += 64) {
+				const index_type len = std::min<index_type>(64, n - i);
+				std::uint64_t hits = len == 64 ? ~std::uint64_t{0} : (std::uint64_t{1} << len) - 1;
+				for (index_type k = 0; hits && k < count; ++k)
+					hits &= matchColumn(cols[words[k]] + i, len, m._masks[words[k]]);
+				for (; hits; hits &= hits - 1)
+					f(i + __builtin_ctzll(hits));
+			}
+		}
+		mask_type word(index_type i) const { return _masks[i]; }
+		static constexpr size_type Words = (Params.MaxComponents-1)/BitsetWidth + 1;
 	private:
-		static constexpr size_type	Size = (Params.MaxComponents-1)/BitsetWidth + 1;
+		static constexpr size_type	Size = Words;
 		mask_type					_masks[Size] ={};
 	};
 	using Mask = std::conditional_t<Params.MaxComponents<=BitsetWidth, SingleMask, MultiMask>;
 
-	static inline index_type compCounter = -1;
+	inline std::atomic<index_type> compCounter{-1};
 	template <class>
 	struct Component final : NoInstance
 	{
-		static inline const index_type		Index = ++compCounter;
+		// storages register from their own static init, which may run before Index's
+		static index_type index() { static const index_type i = ++compCounter; return i; }
+		static inline const index_type		Index = index();
 		static inline const Mask::bit_type	Bit = Mask::bit(Index);
 	};
 
-	struct AddedMask {
-		Mask prev;
-		Mask next;
-		ent_type e;
+	class View final : NoCopy
+	{
+	public:
+		explicit View(const Mask& m) : _mask(m) {}
+
+		const Mask& mask() const { return _mask; }
+		size_type size() const { return _ents.size(); }
+		ent_type operator[](index_type i) const { return _ents[i]; }
+
+		bool contains(ent_type e) const {
+			if (e.id >= _index.capacity())
+				return false;
+			const index_type i = _index[e.id];
+			return i >= 0 && i < _ents.size() && _ents[i].id == e.id;
+		}
+
+		// removing the visited entity swaps an unvisited one into its slot
+		template <class F>
+		void each(F&& f) const {
+			for (index_type i = 0; i < size();) {
+				const ent_type e = _ents[i];
+				f(e);
+				if (i < size() && _ents[i].id == e.id)
+					++i;
+			}
+		}
+
+		void update(ent_type e, const Mask& m) {
+			const bool in = contains(e);
+			if (m.test(_mask)) {
+				if (!in) insert(e);
+			} else if (in) {
+				erase(e);
+			}
+		}
+		void erase(ent_type e) {
+			if (!contains(e))
+				return;
+			const index_type i = _index[e.id];
+			const ent_type last = _ents.pop();
+			_ents[i] = last;
+			_index[last.id] = i;
+		}
+	private:
+		void insert(ent_type e) {
+			_index.ensure(e.id+1);
+			_index[e.id] = _ents.size();
+			_ents.push(e);
+		}
+
+		Mask											_mask;
+		Bag<ent_type,	Params.InitialEntities>			_ents;
+		Bag<index_type,	Params.InitialEntities>			_index;
+	};
+
+	struct Change {
+		ent_type	e;
+		index_type	component;
 	};
 
 	class World final : NoInstance
 	{
 	public:
 		static ent_type createEntity() {
-			if (_ids.size() > 0)
-				return _ids.pop();
+			if (_ids.size() > 0) {
+				const ent_type e = _ids.pop();
+				_handles[e.id] = e;
+				return e;
+			}
 			_masks.push(Mask{});
-			return {++_maxId.id};
+			for (index_type w = 0; w < ColumnCount; ++w)
+				_cols[w].push(0);
+			_handles.push({++_maxId.id, 0});
+			return _maxId;
 		}
 		static void destroyEntity(ent_type ent) {
-			if constexpr (Params.CallbackOnDestroy) {
-				Mask m = _masks[ent.id];
-				int ctz = m.ctz(); // count-trailing-zeros
-				while (ctz >= 0) {
-					if (_callbacks[ctz].destroy != nullptr)
-						_callbacks->destroy(ent);
-					m.clear(Mask::bit(ctz));
-					ctz = m.ctz();
-				}
+			BAGEL_ASSERT(alive(ent));
+			_masks[ent.id].each([ent](index_type c) {
+				if constexpr (Params.AggregateUpdates)
+					_removed.push_back({ent, c});
+				if constexpr (Params.CallbackOnDestroy)
+					if (_callbacks[c].destroy != nullptr)
+						_callbacks[c].destroy(ent);
+			});
+			release(ent);
+		}
+		// destroyEntity on n distinct live entities, walking one storage at a time
+		static void destroyEntities(const ent_type* ents, size_type n) {
+			Mask all;
+			for (size_type i = 0; i < n; ++i) {
+				BAGEL_ASSERT(alive(ents[i]));
+				all.set(_masks[ents[i].id]);
 			}
-			_masks[ent.id].clear();
-			_ids.push(ent);
+			all.each([=](index_type c) {
+				const Mask::bit_type b = Mask::bit(c);
+				const auto destroy = _callbacks[c].destroy;
+				for (size_type i = 0; i < n; ++i)
+					if (_masks[ents[i].id].test(b)) {
+						if constexpr (Params.AggregateUpdates)
+							_removed.push_back({ents[i], c});
+						if constexpr (Params.CallbackOnDestroy)
+							if (destroy != nullptr)
+								destroy(ents[i]);
+					}
+			});
+			for (size_type i = 0; i < n; ++i)
+				release(ents[i]);
 		}
+		static bool alive(ent_type e) {
+			return e.id >= 0 && e.id <= _maxId.id && _handles[e.id] == e;
+		}
+		// current handle for a raw id; its id is -1 while the slot is free
+		static ent_type handle(id_type id) { return _handles[id]; }
 		static const Mask& mask(ent_type e) {
 			return _masks[e.id];
 		}
 		static ent_type maxId() { return _maxId; }
+		// appends every live entity whose mask holds all of m's bits, by id
+		static void match(const Mask& m, std::vector<ent_type>& out) {
+			const auto emit = [&out](index_type i) {
+				if (_handles[i].id == i)
+					out.push_back(_handles[i]);
+			};
+			const mask_type* cols[Mask::Words];
+			if constexpr (Columnar) {
+				for (index_type w = 0; w < Mask::Words; ++w)
+					cols[w] = &_cols[w][0];
+			} else {
+				cols[0] = reinterpret_cast<const mask_type*>(&_masks[0]);
+			}
+			Mask::match(cols, _maxId.id + 1, m, emit);
+		}
 
 		template <class T>
-		static T& getComponent(ent_type e) {
+		static decltype(auto) getComponent(ent_type e) {
+			BAGEL_ASSERT(alive(e));
 			return Storage<T>::type::get(e);
 		}
 
 		template <class T>
 		static void addComponent(ent_type e, const T& t) {
-			Mask prev = _masks[e.id];
-
+			BAGEL_ASSERT(alive(e));
 			_masks[e.id].set(Component<T>::Bit);
+			syncColumn(e, Component<T>::Bit);
 			Storage<T>::type::add(e,t);
+			updateViews(e, Component<T>::Bit);
 
 			if constexpr (Params.AggregateUpdates) {
-				Mask next = _masks[e.id];
-				//_added.push({prev,next,e});
+				_added.push_back({e, Component<T>::Index});
+				setDirty(e, Component<T>::Index);
 			}
 		}
 		template <class T, class...Ts>
@@ -301,8 +1032,14 @@ namespace bagel
 
 		template <class T>
 		static void delComponent(ent_type e) {
+			BAGEL_ASSERT(alive(e));
 			_masks[e.id].clear(Component<T>::Bit);
+			syncColumn(e, Component<T>::Bit);
 			Storage<T>::type::del(e);
+			updateViews(e, Component<T>::Bit);
+
+			if constexpr (Params.AggregateUpdates)
+				_removed.push_back({e, Component<T>::Index});
 		}
 		template <class T, class ...Ts>
 		static void delComponents(ent_type e) {
@@ -311,22 +1048,198 @@ namespace bagel
 				delComponents<Ts...>(e);
 		}
 
+		template <class ...Ts>
+		static const View& view() {
+			static BAGEL_WORLD_LOCAL View v{[] {
+				Mask m;
+				(m.set(Component<Ts>::Bit), ...);
+				return m;
+			}()};
+			[[maybe_unused]] static BAGEL_WORLD_LOCAL const bool reg = registerView(v);
+			return v;
+		}
+
+		// f(ent_type, Ts&...) for every entity holding all Ts; no structural
+		// changes allowed. Driven by the smallest packed Ts, else by view<Ts...>
+		template <class ...Ts, class F>
+		static void each(F&& f) {
+			join<Ts...>([](index_type n, auto&& visit) {
+				for (index_type i = 0; i < n; ++i)
+					visit(i);
+			}, f);
+		}
+		template <class ...Ts, class F>
+		static void eachParallel(F&& f) {
+			if constexpr (ThreadLocalWorld) {
+				each<Ts...>(f);
+				return;
+			}
+			join<Ts...>([](index_type n, auto&& visit) {
+				ThreadPool::global().parallelFor(n, [&](index_type b, index_type e) {
+					for (index_type i = b; i < e; ++i)
+						visit(i);
+				});
+			}, f);
+		}
+
 		template <class T>
 		static void registerStorage(StorageCallbacks& cb) {
-			_callbacks[Component<T>::Index] = cb;
+			_callbacks[Component<T>::index()] = cb;
+		}
+
+		// change log and dirty bits since the last step(); writes through
+		// getComponent are only seen once reported with markChanged
+		template <class T>
+		static void markChanged(ent_type e) {
+			if constexpr (Params.AggregateUpdates)
+				if (!testDirty(e.id, Component<T>::Index)) {
+					// systems writing different components may mark concurrently
+					std::lock_guard lock(_logMutex);
+					_changed.push_back({e, Component<T>::Index});
+					setDirty(e, Component<T>::Index);
+				}
+		}
+		// added or marked changed since the last step()
+		template <class T>
+		static bool changed(ent_type e) { return testDirty(e.id, Component<T>::Index); }
+		// f(ent_type) for every live holder of T that is dirty
+		template <class T, class F>
+		static void eachChanged(F&& f) {
+			const auto& words = _dirty[Component<T>::Index];
+			for (index_type w = 0; w < static_cast<index_type>(words.size()); ++w)
+				for (std::uint64_t bits = words[w]; bits; bits &= bits - 1) {
+					const ent_type e = _handles[w*64 + __builtin_ctzll(bits)];
+					if (e.id >= 0 && _masks[e.id].test(Component<T>::Bit))
+						f(e);
+				}
 		}
 
-		// static size_type sizeAdded() { return _added.size(); }
-		// static const AddedMask& getAdded(int i) { return _added[i]; }
-		//
-		// static void step() { _added.clear(); }
+		static size_type sizeAdded() { return _added.size(); }
+		static const Change& getAdded(index_type i) { return _added[i]; }
+		static size_type sizeRemoved() { return _removed.size(); }
+		static const Change& getRemoved(index_type i) { return _removed[i]; }
+		static size_type sizeChanged() { return _changed.size(); }
+		static const Change& getChanged(index_type i) { return _changed[i]; }
+
+		static void step() {
+			for (const Change& c : _added)
+				_dirty[c.component][c.e.id / 64] = 0;
+			for (const Change& c : _changed)
+				_dirty[c.component][c.e.id / 64] = 0;
+			_added.clear();
+			_removed.clear();
+			_changed.clear();
+		}
 	private:
+		// MultiMask words are mirrored word-major so match() streams only the columns it needs
+		static constexpr bool		Columnar = std::is_same_v<Mask, MultiMask>;
+		static constexpr size_type	ColumnCount = Columnar ? MultiMask::Words : 0;
+
+		template <class B>
+		static void syncColumn(ent_type e, const B& b) {
+			if constexpr (Columnar)
+				_cols[b.index][e.id] = _masks[e.id].word(b.index);
+		}
+		static void release(ent_type ent) {
+			_masks[ent.id].clear();
+			for (index_type w = 0; w < ColumnCount; ++w)
+				_cols[w][ent.id] = 0;
+			for (index_type i = 0; i < _views.size(); ++i)
+				_views[i]->erase(ent);
+			_handles[ent.id].id = -1;
+			++ent.gen;
+			_ids.push(ent);
+		}
+		static void setDirty(ent_type e, index_type c) {
+			auto& words = _dirty[c];
+			if (e.id / 64 >= static_cast<index_type>(words.size()))
+				words.resize(e.id / 64 + 1);
+			words[e.id / 64] |= std::uint64_t{1} << (e.id % 64);
+		}
+		static bool testDirty(id_type id, index_type c) {
+			const auto& words = _dirty[c];
+			return id / 64 < static_cast<index_type>(words.size()) &&
+				(words[id / 64] >> (id % 64) & 1);
+		}
+
+		template <class T>
+		static constexpr bool IsPacked = std::is_same_v<typename Storage<T>::type, PackedStorage<T>>;
+
+		template <class T>
+		static size_type packedSize() {
+			if constexpr (IsPacked<T>)
+				return Storage<T>::type::size();
+			else
+				return -1;
+		}
+
+		template <class ...Ts, class Run, class F>
+		static void join(Run&& run, F& f) {
+			const size_type sizes[] = {packedSize<Ts>()...};
+			index_type driver = -1;
+			for (index_type i = 0; i < static_cast<index_type>(sizeof...(Ts)); ++i)
+				if (sizes[i] >= 0 && (driver < 0 || sizes[i] < sizes[driver]))
+					driver = i;
+
+			if (driver < 0) {
+				const View& v = view<Ts...>();
+				run(v.size(), [&](index_type i) {
+					const ent_type e = v[i];
+					f(e, getComponent<Ts>(e)...);
+				});
+				return;
+			}
+			index_type k = 0;
+			((k++ == driver ? drive<Ts, Ts...>(run, f) : void()), ...);
+		}
+		template <class D, class ...Ts, class Run, class F>
+		static void drive(Run& run, F& f) {
+			if constexpr (IsPacked<D>) {
+				using S = typename Storage<D>::type;
+				Mask m;
+				(m.set(Component<Ts>::Bit), ...);
+				run(S::size(), [&](index_type i) {
+					const ent_type e = S::entity(i);
+					if (_masks[e.id].test(m))
+						f(e, fetch<Ts, D>(e, i)...);
+				});
+			}
+		}
+		template <class T, class D>
+		static decltype(auto) fetch(ent_type e, index_type i) {
+			if constexpr (std::is_same_v<T, D>)
+				return Storage<D>::type::get(i);
+			else
+				return getComponent<T>(e);
+		}
+
+		static void updateViews(ent_type e, const Mask::bit_type& b) {
+			for (index_type i = 0; i < _views.size(); ++i)
+				if (_views[i]->mask().test(b))
+					_views[i]->update(e, _masks[e.id]);
+		}
+		static bool registerView(View& v) {
+			std::lock_guard lock(_logMutex);
+			for (id_type id = 0; id <= _maxId.id; ++id)
+				if (_handles[id].id == id)
+					v.update(_handles[id], _masks[id]);
+			_views.push(&v);
+			return true;
+		}
+
 		static inline StorageCallbacks _callbacks[Params.MaxComponents] = {nullptr};
-		//static inline Bag<AddedMask,1000>		_added;
+		static inline std::mutex _logMutex;
+		static inline BAGEL_WORLD_LOCAL std::vector<Change>					_added;
+		static inline BAGEL_WORLD_LOCAL std::vector<Change>					_removed;
+		static inline BAGEL_WORLD_LOCAL std::vector<Change>					_changed;
+		static inline BAGEL_WORLD_LOCAL std::vector<std::uint64_t>			_dirty[Params.MaxComponents];
 
-		static inline ent_type								_maxId{-1};
-		static inline Bag<Mask,		Params.InitialEntities> _masks;
-		static inline Bag<ent_type,	Params.IdBagSize>		_ids;
+		static inline BAGEL_WORLD_LOCAL ent_type								_maxId{-1, 0};
+		static inline BAGEL_WORLD_LOCAL Bag<Mask,		Params.InitialEntities> _masks;
+		static inline BAGEL_WORLD_LOCAL Bag<ent_type,	Params.InitialEntities> _handles;
+		static inline BAGEL_WORLD_LOCAL Bag<mask_type,	Params.InitialEntities> _cols[Columnar ? ColumnCount : 1];
+		static inline BAGEL_WORLD_LOCAL Bag<ent_type,	Params.IdBagSize>		_ids;
+		static inline BAGEL_WORLD_LOCAL Bag<View*,	Params.MaxViews>		_views;
 	};
 
 	template <class T>
@@ -349,7 +1262,7 @@ namespace bagel
 
 		const Mask& mask() const { return World::mask(_ent); }
 
-		template <class T> T& get() const { return World::getComponent<T>(_ent); }
+		template <class T> decltype(auto) get() const { return World::getComponent<T>(_ent); }
 		template <class T> void add(const T& t) const {
 			return World::addComponent<T>(_ent, t);
 		}
@@ -382,4 +1295,278 @@ namespace bagel
 	private:
 		Mask m;
 	};
+
+	// records structural changes (from any thread) and applies them in one batch
+	// at play(); handles from create() are only valid inside the same buffer
+	class CommandBuffer final : NoCopy
+	{
+	public:
+		ent_type create() {
+			std::lock_guard lock(_mutex);
+			return {-2 - _creates++, 0};
+		}
+		void destroy(ent_type e) {
+			std::lock_guard lock(_mutex);
+			_destroys.push_back(e);
+		}
+		template <class T>
+		void add(ent_type e, const T& t) {
+			static_assert(std::is_trivially_copyable_v<T>);
+			std::lock_guard lock(_mutex);
+			const size_type at = _data.size();
+			_data.resize(at + sizeof(T));
+			memcpy(&_data[at], &t, sizeof(T));
+			_ops.push_back({[](ent_type e, const unsigned char* p) {
+				T t;
+				memcpy(&t, p, sizeof(T));
+				World::addComponent(e, t);
+			}, e, at});
+		}
+		template <class T, class...Ts>
+		void addAll(ent_type e, const T& t, const Ts&... ts) {
+			add(e, t);
+			(add(e, ts), ...);
+		}
+		template <class T>
+		void del(ent_type e) {
+			std::lock_guard lock(_mutex);
+			_ops.push_back({[](ent_type e, const unsigned char*) {
+				World::delComponent<T>(e);
+			}, e, 0});
+		}
+		// runs after all structural changes, in record order
+		template <class F>
+		void call(F&& f) {
+			std::lock_guard lock(_mutex);
+			_calls.emplace_back(std::forward<F>(f));
+		}
+
+		bool destroying(ent_type e) const {
+			std::lock_guard lock(_mutex);
+			return std::find(_destroys.begin(), _destroys.end(), e) != _destroys.end();
+		}
+		bool empty() const {
+			std::lock_guard lock(_mutex);
+			return _creates == 0 && _destroys.empty() && _ops.empty() && _calls.empty();
+		}
+
+		// creates, then adds/dels in record order, then destroys by descending
+		// id so the free list hands back the lowest ids first, then calls
+		void play() {
+			std::vector<std::function<void()>> calls;
+			{
+				std::lock_guard lock(_mutex);
+				_created.clear();
+				for (index_type i = 0; i < _creates; ++i)
+					_created.push_back(World::createEntity());
+				for (const Op& op : _ops) {
+					const ent_type e = resolve(op.e);
+					if (World::alive(e))
+						op.apply(e, _data.data() + op.at);
+				}
+				for (ent_type& e : _destroys)
+					e = resolve(e);
+				std::sort(_destroys.begin(), _destroys.end(), [](ent_type a, ent_type b) { return a.id > b.id; });
+				for (ent_type e : _destroys)
+					if (World::alive(e))
+						World::destroyEntity(e);
+				calls.swap(_calls);
+				_creates = 0;
+				_destroys.clear();
+				_ops.clear();
+				_data.clear();
+			}
+			// calls may record into this buffer again; those wait for the next play()
+			for (auto& f : calls)
+				f();
+		}
+	private:
+		struct Op {
+			void		(*apply)(ent_type, const unsigned char*);
+			ent_type	e;
+			size_type	at;
+		};
+		ent_type resolve(ent_type e) const {
+			return e.id < -1 ? _created[-2 - e.id] : e;
+		}
+
+		mutable std::mutex					_mutex;
+		index_type							_creates = 0;
+		std::vector<ent_type>				_created;
+		std::vector<ent_type>				_destroys;
+		std::vector<Op>						_ops;
+		std::vector<unsigned char>			_data;
+		std::vector<std::function<void()>>	_calls;
+	};
+
+	// runs a frame of systems as a DAG: a system waits for every earlier one
+	// whose writes overlap its reads or writes, or whose reads overlap its
+	// writes. Exclusive systems (structural changes, rendering) run alone on
+	// the calling thread; the others go to whichever pool thread is free
+	class Scheduler final : NoCopy
+	{
+	public:
+		class System
+		{
+		public:
+			template <class ...Ts>
+			System& reads() { (_reads.set(Component<Ts>::Bit), ...); return *this; }
+			template <class ...Ts>
+			System& writes() { (_writes.set(Component<Ts>::Bit), ...); return *this; }
+			System& exclusive() { _exclusive = true; return *this; }
+		private:
+			friend class Scheduler;
+			const char*				_name = nullptr;
+			std::function<void()>	_run;
+			Mask					_reads, _writes;
+			bool					_exclusive = false;
+			std::vector<index_type>	_prev, _next;
+			index_type				_pending = 0;
+		};
+		// times are in ns from the start of the frame
+		struct Span {
+			const char*		name;
+			std::int64_t	begin, end;
+			std::thread::id	thread;
+			bool			critical;
+		};
+
+		// the returned System is only valid until the next add()
+		template <class F>
+		System& add(const char* name, F&& f) {
+			_built = false;
+			System& s = _systems.emplace_back();
+			s._name = name;
+			s._run = std::forward<F>(f);
+			return s;
+		}
+
+		void run() {
+			if (!_built)
+				build();
+			_start = std::chrono::steady_clock::now();
+			for (System& s : _systems)
+				s._pending = static_cast<index_type>(s._prev.size());
+
+			const index_type n = static_cast<index_type>(_systems.size());
+			for (index_type a = 0; a < n;) {
+				if (_systems[a]._exclusive) {
+					runOne(a);
+					finish(a, a);
+					++a;
+					continue;
+				}
+				index_type b = a;
+				while (b < n && !_systems[b]._exclusive)
+					++b;
+				runSegment(a, b);
+				a = b;
+			}
+			markCritical();
+		}
+
+		// the last run(), in declaration order
+		const std::vector<Span>& timeline() const { return _timeline; }
+	private:
+		static bool conflict(const System& a, const System& b) {
+			return a._exclusive || b._exclusive || overlap(a._writes, b._writes) ||
+				overlap(a._writes, b._reads) || overlap(a._reads, b._writes);
+		}
+		static bool overlap(const Mask& a, const Mask& b) {
+			for (size_type w = 0; w < Mask::Words; ++w)
+				if (a.word(w) & b.word(w))
+					return true;
+			return false;
+		}
+		void build() {
+			for (System& s : _systems) {
+				s._prev.clear();
+				s._next.clear();
+			}
+			for (index_type j = 0; j < static_cast<index_type>(_systems.size()); ++j)
+				for (index_type i = 0; i < j; ++i)
+					if (conflict(_systems[i], _systems[j])) {
+						_systems[i]._next.push_back(j);
+						_systems[j]._prev.push_back(i);
+					}
+			_timeline.assign(_systems.size(), {});
+			_built = true;
+		}
+
+		void runOne(index_type i) {
+			Span& span = _timeline[i];
+			span.name = _systems[i]._name;
+			span.thread = std::this_thread::get_id();
+			span.begin = elapsed();
+			_systems[i]._run();
+			span.end = elapsed();
+		}
+		// releases i's successors, queueing the ones in [.., end) that became ready
+		void finish(index_type i, index_type end) {
+			for (index_type j : _systems[i]._next)
+				if (--_systems[j]._pending == 0 && j < end)
+					_ready.push_back(j);
+		}
+		// runs the non-exclusive systems [a,b); all earlier ones are done
+		void runSegment(index_type a, index_type b) {
+			_ready.clear();
+			for (index_type i = a; i < b; ++i)
+				if (_systems[i]._pending == 0)
+					_ready.push_back(i);
+			_left = b - a;
+
+			// a World per thread can't be shared with the pool
+			const index_type threads = ThreadLocalWorld ? 1 : ThreadPool::global().workers() + 1;
+			ThreadPool::global().parallelFor(std::min(threads, _left), [&](index_type, index_type) {
+				std::unique_lock lock(_mutex);
+				while (true) {
+					_wake.wait(lock, [this] { return !_ready.empty() || _left == 0; });
+					if (_left == 0)
+						return;
+					const index_type i = _ready.back();
+					_ready.pop_back();
+					lock.unlock();
+					runOne(i);
+					lock.lock();
+					--_left;
+					finish(i, b);
+					_wake.notify_all();
+				}
+			}, 1);
+		}
+
+		// walks back from the last system to finish through the latest-finishing dependency
+		void markCritical() {
+			index_type i = -1;
+			for (index_type k = 0; k < static_cast<index_type>(_timeline.size()); ++k) {
+				_timeline[k].critical = false;
+				if (i < 0 || _timeline[k].end > _timeline[i].end)
+					i = k;
+			}
+			while (i >= 0) {
+				_timeline[i].critical = true;
+				index_type p = -1;
+				for (index_type k : _systems[i]._prev)
+					if (p < 0 || _timeline[k].end > _timeline[p].end)
+						p = k;
+				i = p;
+			}
+		}
+		std::int64_t elapsed() const {
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - _start).count();
+		}
+
+		std::vector<System>						_systems;
+		std::vector<Span>						_timeline;
+		std::vector<index_type>					_ready;
+		index_type								_left = 0;
+		bool									_built = false;
+		std::chrono::steady_clock::time_point	_start;
+		std::mutex								_mutex;
+		std::condition_variable					_wake;
+	};
 }
+
+// selects a storage for a component declared after bagel.h, at global scope
+#define BAGEL_STORAGE(C,T) namespace bagel { template <> struct Storage<C> { using type = T<C>; }; }
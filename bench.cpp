@@ -0,0 +1,366 @@
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <thread>
+#include <vector>
+#include "bagel.h"
+using namespace std;
+using namespace bagel;
+
+namespace
+{
+	struct Body { float x, y, angle; };
+	struct Pose { float x, y, a; };
+
+	// mirrors of the game's Position / Drawable, once array-of-structs and once split
+	struct FPoint { float x, y; };
+	struct FRect { float x, y, w, h; };
+	struct Xform { float x, y, angle; };
+	struct Position { FPoint p; float a; };
+	struct Sprite { FRect part; float scale; };
+	struct SoAXform : Xform {};
+	struct SoAPosition : Position {};
+	struct SoASprite : Sprite {};
+}
+
+BAGEL_STORAGE(Body, PackedStorage)
+BAGEL_STORAGE(Pose, PackedStorage)
+BAGEL_STORAGE(Xform, PackedStorage)
+BAGEL_STORAGE(Position, PackedStorage)
+BAGEL_STORAGE(Sprite, PackedStorage)
+BAGEL_STORAGE(SoAXform, SoAStorage)
+BAGEL_STORAGE(SoAPosition, SoAStorage)
+BAGEL_STORAGE(SoASprite, SoAStorage)
+
+namespace bagel
+{
+	template <> struct SoALayout<SoAXform> {
+		using type = Fields<Field<&SoAXform::x>, Field<&SoAXform::y>, Field<&SoAXform::angle>>;
+	};
+	template <> struct SoALayout<SoAPosition> {
+		using type = Fields<Field<&SoAPosition::p, &FPoint::x>, Field<&SoAPosition::p, &FPoint::y>,
+							Field<&SoAPosition::a>>;
+	};
+	template <> struct SoALayout<SoASprite> {
+		using type = Fields<Field<&SoASprite::part, &FRect::w>, Field<&SoASprite::part, &FRect::h>,
+							Field<&SoASprite::scale>>;
+	};
+}
+
+namespace
+{
+	struct Value { int v; };
+	struct Match1 {};
+	struct Match10 {};
+	struct Match25 {};
+	struct Match50 {};
+
+	volatile long long sink;
+
+	template <class F>
+	double nsPerEntity(F&& f, int entities) {
+		constexpr int Runs = 10;
+		auto start = chrono::steady_clock::now();
+		for (int r = 0; r < Runs; ++r)
+			f();
+		auto end = chrono::steady_clock::now();
+		return chrono::duration<double, nano>(end - start).count() / Runs / entities;
+	}
+
+	// grows the Value population to entities, counting only its own, so it does not
+	// depend on which benchmarks ran before it
+	void growTo(int entities) {
+		const View& values = World::view<Value>();
+		for (int n = values.size(); n < entities; ++n) {
+			Entity e = Entity::create();
+			e.add(Value{n});
+			if (n % 100 == 0) e.add(Match1{});
+			if (n % 10 == 0) e.add(Match10{});
+			if (n % 4 == 0) e.add(Match25{});
+			if (n % 2 == 0) e.add(Match50{});
+		}
+	}
+
+	template <class M>
+	void scanVsView(int entities, int percent) {
+		const Mask mask = MaskBuilder().set<Value>().set<M>().build();
+
+		const double scan = nsPerEntity([&] {
+			long long sum = 0;
+			for (ent_type e{0, 0}; e.id <= World::maxId().id; ++e.id)
+				if (World::mask(e).test(mask))
+					sum += World::getComponent<Value>(e).v;
+			sink = sum;
+		}, entities);
+
+		const View& view = World::view<M, Value>();
+		const double viewed = nsPerEntity([&] {
+			long long sum = 0;
+			view.each([&](ent_type e) {
+				sum += World::getComponent<Value>(e).v;
+			});
+			sink = sum;
+		}, entities);
+
+		cout << setw(9) << entities << setw(8) << percent << '%'
+			 << setw(12) << fixed << setprecision(3) << scan
+			 << setw(12) << viewed
+			 << setw(10) << setprecision(1) << scan / viewed << "x\n";
+	}
+
+	void viewBenchmark() {
+		cout << "World::view vs. full mask scan (ns per entity in world)\n"
+			 << " entities   match        scan        view   speedup\n";
+		for (int entities : {10'000, 100'000, 1'000'000}) {
+			growTo(entities);
+			scanVsView<Match1>(entities, 1);
+			scanVsView<Match10>(entities, 10);
+			scanVsView<Match25>(entities, 25);
+			scanVsView<Match50>(entities, 50);
+		}
+	}
+
+	void syncBenchmark() {
+		cout << "\nbox_system-style Body -> Pose copy (ns per entity)\n"
+			 << " entities        view        join    parallel\n";
+		const View& view = World::view<Body, Pose>();
+		vector<ent_type> ents;
+		for (int entities : {10'000, 100'000, 1'000'000}) {
+			while (static_cast<int>(ents.size()) < entities) {
+				const ent_type e = World::createEntity();
+				const float f = float(ents.size());
+				World::addComponents(e, Body{f, f, 0.5f}, Pose{});
+				ents.push_back(e);
+			}
+
+			const double viewed = nsPerEntity([&] {
+				view.each([](ent_type e) {
+					const Body& b = World::getComponent<Body>(e);
+					World::getComponent<Pose>(e) = {b.x * 35.5f, b.y * 35.5f, b.angle * 57.2958f};
+				});
+			}, entities);
+			const double joined = nsPerEntity([] {
+				World::each<Body, Pose>([](ent_type, const Body& b, Pose& p) {
+					p = {b.x * 35.5f, b.y * 35.5f, b.angle * 57.2958f};
+				});
+			}, entities);
+			const double parallel = nsPerEntity([] {
+				World::eachParallel<Body, Pose>([](ent_type, const Body& b, Pose& p) {
+					p = {b.x * 35.5f, b.y * 35.5f, b.angle * 57.2958f};
+				});
+			}, entities);
+
+			cout << setw(9) << entities << fixed << setprecision(3)
+				 << setw(12) << viewed << setw(12) << joined << setw(12) << parallel << '\n';
+		}
+		cout << "(" << ThreadPool::global().workers() + 1 << " threads)\n";
+		World::destroyEntities(ents.data(), static_cast<size_type>(ents.size()));
+	}
+
+	constexpr float Scale = 35.5f, RadToDeg = 57.2958f, Offset = 640.f;
+
+	// kernels take __restrict parameters so the compiler can vectorize without alias checks
+	void copyTransforms(index_type n, const float* __restrict tx, const float* __restrict ty,
+						const float* __restrict ta, float* __restrict px, float* __restrict py,
+						float* __restrict pa) {
+		for (index_type i = 0; i < n; ++i) {
+			px[i] = tx[i] * Scale;
+			py[i] = ty[i] * Scale;
+			pa[i] = ta[i] * RadToDeg;
+		}
+	}
+	void dstRects(index_type n, const float* __restrict px, const float* __restrict py,
+				  const float* __restrict w, const float* __restrict h, const float* __restrict s,
+				  float* __restrict ox, float* __restrict oy, float* __restrict ow, float* __restrict oh) {
+		for (index_type i = 0; i < n; ++i) {
+			ow[i] = w[i] * s[i];
+			oh[i] = h[i] * s[i];
+			ox[i] = px[i] - ow[i] / 2 - Offset;
+			oy[i] = py[i] - oh[i] / 2;
+		}
+	}
+
+	void soaBenchmark() {
+		cout << "\narray-of-structs (PackedStorage) vs. SoAStorage (ns per entity)\n"
+			 << " entities    copy AoS    copy SoA    rect AoS    rect SoA\n";
+
+		vector<FRect> rects;
+		vector<float> rx, ry, rw, rh;
+		vector<ent_type> ents;
+		for (int entities : {10'000, 100'000, 1'000'000}) {
+			while (static_cast<int>(ents.size()) < entities) {
+				const ent_type e = World::createEntity();
+				const float f = float(ents.size());
+				const Xform t{f, f * .5f, .25f};
+				const Sprite d{{0, 0, 118, 118}, .56f};
+				World::addComponents(e, t, Position{}, d);
+				World::addComponents(e, SoAXform{t}, SoAPosition{}, SoASprite{d});
+				ents.push_back(e);
+			}
+			rects.resize(entities);
+			rx.resize(entities), ry.resize(entities), rw.resize(entities), rh.resize(entities);
+
+			// both layouts were filled in lockstep, so dense index i is the same entity everywhere
+			const double copyAoS = nsPerEntity([&] {
+				for (index_type i = 0; i < entities; ++i) {
+					const Xform& t = PackedStorage<Xform>::get(i);
+					PackedStorage<Position>::get(i) = {{t.x * Scale, t.y * Scale}, t.angle * RadToDeg};
+				}
+			}, entities);
+			const double copySoA = nsPerEntity([&] {
+				using X = SoAStorage<SoAXform>;
+				using P = SoAStorage<SoAPosition>;
+				copyTransforms(entities, X::field<0>(), X::field<1>(), X::field<2>(),
+							   P::field<0>(), P::field<1>(), P::field<2>());
+			}, entities);
+			const double rectAoS = nsPerEntity([&] {
+				FRect* out = rects.data();
+				for (index_type i = 0; i < entities; ++i) {
+					const Position& p = PackedStorage<Position>::get(i);
+					const Sprite& d = PackedStorage<Sprite>::get(i);
+					out[i] = {
+						p.p.x - d.part.w * d.scale / 2 - Offset,
+						p.p.y - d.part.h * d.scale / 2,
+						d.part.w * d.scale,
+						d.part.h * d.scale
+					};
+				}
+			}, entities);
+			const double rectSoA = nsPerEntity([&] {
+				using P = SoAStorage<SoAPosition>;
+				using S = SoAStorage<SoASprite>;
+				dstRects(entities, P::field<0>(), P::field<1>(), S::field<0>(), S::field<1>(),
+						 S::field<2>(), rx.data(), ry.data(), rw.data(), rh.data());
+			}, entities);
+
+			cout << setw(9) << entities << fixed << setprecision(3)
+				 << setw(12) << copyAoS << setw(12) << copySoA
+				 << setw(12) << rectAoS << setw(12) << rectSoA << '\n';
+		}
+		sink = static_cast<long long>(rects[1].x + rx[1]);
+		World::destroyEntities(ents.data(), static_cast<size_type>(ents.size()));
+	}
+
+	template <class M>
+	void scanVsMatch(int entities, int percent) {
+		const Mask mask = MaskBuilder().set<Value>().set<M>().build();
+		vector<ent_type> out;
+		out.reserve(entities);
+
+		const double scan = nsPerEntity([&] {
+			out.clear();
+			for (id_type id = 0; id <= World::maxId().id; ++id)
+				if (World::mask(World::handle(id)).test(mask))
+					out.push_back(World::handle(id));
+			sink = out.size();
+		}, entities);
+
+		const double matched = nsPerEntity([&] {
+			out.clear();
+			World::match(mask, out);
+			sink = out.size();
+		}, entities);
+
+		cout << setw(9) << entities << setw(8) << percent << '%'
+			 << setw(12) << fixed << setprecision(3) << scan
+			 << setw(12) << matched
+			 << setw(10) << setprecision(1) << scan / matched << "x\n";
+	}
+
+	void matchBenchmark() {
+		cout << "\nWorld::match vs. per-id Mask::test, MaxComponents = " << Params.MaxComponents
+			 << " (ns per entity in world)\n"
+			 << " entities   match        scan       match   speedup\n";
+		for (int entities : {10'000, 100'000, 1'000'000}) {
+			growTo(entities);
+			scanVsMatch<Match1>(entities, 1);
+			scanVsMatch<Match10>(entities, 10);
+			scanVsMatch<Match50>(entities, 50);
+		}
+	}
+
+	template <class A>
+	void growBag(const char* name) {
+		constexpr int Pushes = 1 << 22;
+		DynamicBag<Xform, 1024, A> bag;
+		double worst = 0;
+		const auto start = chrono::steady_clock::now();
+		for (int i = 0; i < Pushes; ++i) {
+			if (bag.size() == bag.capacity()) {
+				const auto before = chrono::steady_clock::now();
+				bag.push({float(i), 0, 0});
+				worst = max(worst, chrono::duration<double, micro>(chrono::steady_clock::now() - before).count());
+			} else {
+				bag.push({float(i), 0, 0});
+			}
+		}
+		const auto end = chrono::steady_clock::now();
+		sink = static_cast<long long>(bag[Pushes - 1].x);
+		cout << setw(9) << name << fixed << setprecision(3)
+			 << setw(12) << chrono::duration<double, nano>(end - start).count() / Pushes
+			 << setw(14) << setprecision(1) << worst << '\n';
+	}
+
+	void allocBenchmark() {
+		cout << "\nDynamicBag growth to 4M Xforms by allocator\n"
+			 << "allocator   ns/push  worst grow us\n";
+		growBag<HeapAllocator>("heap");
+		growBag<ArenaAllocator>("arena");
+		growBag<VirtualAllocator>("virtual");
+		growBag<PoolAllocator>("pool");
+	}
+
+	// one independent World per thread, each stepping its own Body -> Pose sync
+	void worldsBenchmark() {
+		cout << "\nIndependent worlds on separate threads, 100k entities x 100 steps each\n";
+		if constexpr (!ThreadLocalWorld) {
+			cout << "(needs BAGEL_THREAD_LOCAL_WORLD, see bagel_bench_worlds)\n";
+			return;
+		}
+		cout << "   worlds     wall ms  Mstep/s\n";
+		constexpr int Entities = 100'000, Steps = 100;
+		for (int worlds : {1, 2, 4, 8}) {
+			atomic<bool> isolated{true};
+			const auto start = chrono::steady_clock::now();
+			vector<thread> threads;
+			for (int w = 0; w < worlds; ++w)
+				threads.emplace_back([&isolated] {
+					for (int i = 0; i < Entities; ++i)
+						Entity::create().addAll(Body{float(i), float(i), 0.5f}, Pose{});
+					for (int s = 0; s < Steps; ++s)
+						World::each<Body, Pose>([](ent_type, const Body& b, Pose& p) {
+							p = {b.x, b.y, b.angle};
+						});
+					if (World::view<Body, Pose>().size() != Entities)
+						isolated = false;
+				});
+			for (auto& t : threads)
+				t.join();
+			const double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+			cout << setw(9) << worlds << setw(12) << fixed << setprecision(1) << ms
+				 << setw(9) << double(worlds) * Entities * Steps / ms / 1000
+				 << (isolated ? "" : "  worlds leaked into each other!") << '\n';
+		}
+	}
+}
+
+// runs every benchmark, or only the ones named on the command line
+int main(int argc, char** argv)
+{
+	const auto wanted = [&](const char* name) {
+		if (argc < 2)
+			return true;
+		for (int i = 1; i < argc; ++i)
+			if (string(argv[i]) == name)
+				return true;
+		return false;
+	};
+	if (wanted("view")) viewBenchmark();
+	if (wanted("sync")) syncBenchmark();
+	if (wanted("soa")) soaBenchmark();
+	if (wanted("match")) matchBenchmark();
+	if (wanted("alloc")) allocBenchmark();
+	if (wanted("worlds")) worldsBenchmark();
+	return 0;
+}
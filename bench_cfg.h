@@ -0,0 +1,15 @@
+#pragma once
+
+#ifndef BAGEL_BENCH_MAX_COMPONENTS
+	#define BAGEL_BENCH_MAX_COMPONENTS 64
+#endif
+
+constexpr Bagel Params{
+	.AggregateUpdates = false,
+	.DynamicResize = true,
+	.IdBagSize = 1 << 16,
+	.InitialEntities = 1 << 16,
+	.InitialPackedSize = 1 << 16,
+	.MaxComponents = BAGEL_BENCH_MAX_COMPONENTS,
+	.PoolBytes = std::size_t{1} << 28
+};
@@ -0,0 +1,76 @@
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <thread>
+#include <vector>
+#include <box2d/box2d.h>
+#include "bagel.h"
+using namespace std;
+using namespace bagel;
+
+namespace
+{
+	// a pyramid of base*(base+1)/2 dynamic boxes on a static ground, stepped
+	// with a TaskSystem of the given size; returns ms per step
+	double stepPyramid(int threads, int base, int steps) {
+		TaskSystem tasks(threads);
+		b2WorldDef def = b2DefaultWorldDef();
+		def.workerCount = tasks.workers();
+		def.enqueueTask = TaskSystem::enqueueTask;
+		def.finishTask = TaskSystem::finishTask;
+		def.userTaskContext = &tasks;
+		const b2WorldId world = b2CreateWorld(&def);
+
+		b2BodyDef groundDef = b2DefaultBodyDef();
+		const b2BodyId ground = b2CreateBody(world, &groundDef);
+		const b2Polygon groundBox = b2MakeOffsetBox(base + 10.f, 1.f, {0, -1.f}, b2Rot_identity);
+		const b2ShapeDef shapeDef = b2DefaultShapeDef();
+		b2CreatePolygonShape(ground, &shapeDef, &groundBox);
+
+		const b2Polygon box = b2MakeBox(0.5f, 0.5f);
+		for (int row = 0; row < base; ++row)
+			for (int col = row; col < base; ++col) {
+				b2BodyDef bodyDef = b2DefaultBodyDef();
+				bodyDef.type = b2_dynamicBody;
+				bodyDef.position = {col - 0.5f * (base + row), 0.5f + row};
+				b2CreatePolygonShape(b2CreateBody(world, &bodyDef), &shapeDef, &box);
+			}
+
+		// let the stack settle into contact before timing
+		for (int s = 0; s < 10; ++s)
+			b2World_Step(world, 1.f / 60, 4);
+		const auto start = chrono::steady_clock::now();
+		for (int s = 0; s < steps; ++s)
+			b2World_Step(world, 1.f / 60, 4);
+		const double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		b2DestroyWorld(world);
+		return ms / steps;
+	}
+}
+
+// box_bench [base] [steps] [threads]: Box2D step time for 1..threads solver threads
+// (default: every core)
+int main(int argc, char** argv)
+{
+	const int base = argc > 1 ? stoi(argv[1]) : 90;
+	const int steps = argc > 2 ? stoi(argv[2]) : 200;
+	const int cores = argc > 3 ? stoi(argv[3]) : static_cast<int>(max(1u, thread::hardware_concurrency()));
+
+	cout << "Box2D pyramid, " << base * (base + 1) / 2 << " dynamic bodies x " << steps << " steps\n"
+		 << "  threads  ms/step  speedup\n";
+	vector<int> counts;
+	for (int threads = 1; threads < cores; threads *= 2)
+		counts.push_back(threads);
+	counts.push_back(cores);
+
+	double serial = 0;
+	for (int threads : counts) {
+		const double ms = stepPyramid(threads, base, steps);
+		if (threads == 1)
+			serial = ms;
+		cout << setw(9) << threads << setw(9) << fixed << setprecision(3) << ms
+			 << setw(8) << setprecision(2) << serial / ms << "x\n";
+	}
+	return 0;
+}
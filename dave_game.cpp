@@ -1,6 +1,13 @@
 #include "dave_game.h"
 #include "bagel.h"
 #include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <thread>
 #include <SDL3/SDL.h>
 #include <SDL3_image/SDL_image.h>
 #include <box2d/box2d.h>
@@ -13,10 +20,12 @@ namespace dave_game{
     void DaveGame::run()
     {
         SDL_SetRenderDrawColor(ren, 0,0,0,255);
-        auto start = SDL_GetTicks();
+        FixedTimestep clock(STEP_NS, MAX_SUBSTEPS);
+        clock.reset();
         bool quit = false;
 
         while (!quit) {
+            const int steps = clock.advance();
 
             switch ((GameState)m_gameState) {
                 case GameState::MENU:
@@ -26,15 +35,9 @@ namespace dave_game{
                     }
                     break;
                 case GameState::PLAYING:
-                    InputSystem();
-                    MovementSystem();
-                    CircularMotionSystem();
-                    BackAndForthMotionSystem();
-                    ShooterSystem();
-                    box_system();
-                    CollisionSystem();
-                    AnimationSystem();
-                    StatusBarSystem();
+                    for (int i = 0; i < steps; ++i)
+                        step();
+                    renderAlpha = clock.alpha();
                     RenderSystem();
                     break;
                 case GameState::EXIT:
@@ -45,28 +48,39 @@ namespace dave_game{
 
             }
 
-            auto end = SDL_GetTicks();
-            if (end-start < GAME_FRAME) {
-                SDL_Delay(GAME_FRAME - (end-start));
-            }
+            // without vsync nothing else paces the loop
+            if (!vsync)
+                SDL_DelayNS(clock.untilNextStep());
 
-            start += GAME_FRAME;
             SDL_Event e;
             while (SDL_PollEvent(&e)) {
                 if (e.type == SDL_EVENT_QUIT)
                     m_gameState = GameState::EXIT;
                 else if ((e.type == SDL_EVENT_KEY_DOWN) && (e.key.scancode == SDL_SCANCODE_ESCAPE))
                     m_gameState = GameState::MENU;
+                else if (e.type == SDL_EVENT_RENDER_TARGETS_RESET)
+                    bakeStaticLayer();
+#ifndef NDEBUG
+                else if ((e.type == SDL_EVENT_KEY_DOWN) && (e.key.scancode == SDL_SCANCODE_F1))
+                    physicsOverlay.enabled = !physicsOverlay.enabled;
+#endif
             }
         }
     }
 
-    DaveGame::DaveGame() {
-        if (!prepareWindowAndTexture())
+    DaveGame::DaveGame(bool headless) : headless(headless) {
+        if (!headless && !prepareWindowAndTexture())
             return;
-        SDL_srand(time(nullptr));
+        SDL_srand(headless ? 0 : time(nullptr));
 
         prepareBoxWorld();
+        buildFrame();
+        buildCollisions();
+        dumpTimeline = getenv("DAVE_TIMELINE") != nullptr;
+        if (const char* path = getenv("DAVE_RECORD"))
+            recordInput(path);
+        if (const char* path = getenv("DAVE_REPLAY"); path && !replayInput(path))
+            cout << "Could not read input log " << path << endl;
         loadLevel(gameInfo.level);
 
         //createDave(DAVE_START_COLUMN, 3);
@@ -81,6 +95,9 @@ namespace dave_game{
     */
     DaveGame::~DaveGame()
     {
+        if (!recordPath.empty() && !recording.save(recordPath))
+            cout << "Could not write input log " << recordPath << endl;
+        clearStaticLayer();
         if (b2World_IsValid(boxWorld))
             b2DestroyWorld(boxWorld);
         if (tex != nullptr)
@@ -110,6 +127,8 @@ namespace dave_game{
             return false;
         }
 
+        vsync = SDL_SetRenderVSync(ren, 1);
+
         tex = SDL_CreateTextureFromSurface(ren, surf);
         if (tex == nullptr) {
             cout << SDL_GetError() << endl;
@@ -120,10 +139,463 @@ namespace dave_game{
         return true;
     }
 
+    /// @brief Declares one PLAYING simulation step; rendering runs separately, once per
+    /// displayed frame. Systems that create or destroy entities or pump SDL events are exclusive; the rest run as soon as the earlier systems they
+    /// conflict with are done, so AnimationSystem overlaps the physics chain.
+    void DaveGame::buildFrame()
+    {
+        frame.add("InputSystem", [this] { InputSystem(); }).exclusive();
+        frame.add("ShooterSystem", [this] { ShooterSystem(); }).exclusive();
+        frame.add("MovementSystem", [this] { MovementSystem(); })
+            .reads<Intent, Collider, Position, Dave>()
+            .writes<Animation, GroundStatus, PhysicsWorld>();
+        frame.add("AnimationSystem", [this] { AnimationSystem(); })
+            .writes<Animation, Drawable>();
+        frame.add("CircularMotionSystem", [this] { CircularMotionSystem(); })
+            .reads<Collider>()
+            .writes<CircularMotion, PhysicsWorld>();
+        frame.add("BackAndForthMotionSystem", [this] { BackAndForthMotionSystem(); })
+            .reads<BackAndForthMotion, Position, Collider>()
+            .writes<PhysicsWorld>();
+        frame.add("box_system", [this] { box_system(); })
+            .reads<Collider>()
+            .writes<Position, PrevPosition, PhysicsWorld>();
+        frame.add("DespawnSystem", [this] { DespawnSystem(); }).exclusive();
+        frame.add("CollisionSystem", [this] { CollisionSystem(); }).exclusive();
+        frame.add("StatusBarSystem", [this] { StatusBarSystem(); }).exclusive();
+        frame.add("World::step", [] { World::step(); }).exclusive();
+    }
+
+    /// @brief Registers what CollisionSystem does for each (sensor, visitor) pair of collision classes.
+    void DaveGame::buildCollisions()
+    {
+        using C = CollisionClass;
+
+        collisions.on(C::Dave, C::Wall, [this](ent_type dave, b2BodyId, ent_type wallEnt, b2BodyId) {
+            auto& davePos = World::getComponent<Position>(dave);
+            auto& wallPos = World::getComponent<Position>(wallEnt);
+            const auto& wall = World::getComponent<Wall>(wallEnt);
+
+            float daveBottom = davePos.p.y + (DAVE_JUMPING.h * DAVE_TEX_SCALE / 2);
+            float wallTop = wallPos.p.y - (wall.size.y * BLOCK_TEX_SCALE / 2);
+
+            if (daveBottom <= wallTop + 8.f) {
+                auto& groundStatus = World::getComponent<GroundStatus>(dave);
+                groundStatus.onGround = true;
+                groundStatus.lastLandedTime = simTime();
+            }
+        });
+
+        collisions.on(C::Dave, C::Diamond, [this](ent_type, b2BodyId, ent_type diamondEnt, b2BodyId body) {
+            auto& diamond = World::getComponent<Diamond>(diamondEnt);
+            gameInfo.score +=  diamond.value;
+            destroyLater(diamondEnt, body);
+        });
+
+        collisions.on(C::Dave, C::Door, [this](ent_type, b2BodyId, ent_type doorEnt, b2BodyId) {
+            auto& door = World::getComponent<Door>(doorEnt);
+            if (door.open && !leavingLevel) {
+                leavingLevel = true;
+                commands.call([this] {
+                    //levelAnimation();
+                    loadLevel(++gameInfo.level);
+                    std::cout << "finish load new level: " << std::endl;
+                });
+            }
+        });
+
+        collisions.on(C::Dave, C::Trophy, [this](ent_type, b2BodyId, ent_type trophyEnt, b2BodyId body) {
+            auto& trophy = World::getComponent<Trophy>(trophyEnt);
+            gameInfo.score += trophy.value; // Increase score by 100 for collecting a trophy
+            destroyLater(trophyEnt, body);
+            renderGoThruTheDoor();
+        });
+
+        collisions.on(C::Dave, C::MoveScreen, [this](ent_type, b2BodyId, ent_type sensorEnt, b2BodyId) {
+            auto& moveScreen = World::getComponent<MoveScreenSensor>(sensorEnt);
+            int screen = gameInfo.screenOffset / 0.5f;
+            if (moveScreen.forward &&  moveScreen.col == screen) {
+                gameInfo.screenOffset += .5f; // Move screen forward
+            } else if (!moveScreen.forward && moveScreen.col == screen - 1) {
+                gameInfo.screenOffset -= .5f; // Move screen backward
+            }
+        });
+
+        collisions.on(C::Dave, {C::Spikes, C::Monster, C::Ghost, C::MonsterBullet},
+            [this](ent_type dave, b2BodyId body, ent_type, b2BodyId) {
+                if (leavingLevel)
+                    return; // already died or left through the door in this step
+                leavingLevel = true;
+                gameInfo.lives--;
+                if (gameInfo.lives <= 0) {
+                    commands.call([this] { EndGame(); }); // End game if no lives left
+                    return;
+                }
+
+                gameInfo.screenOffset = 0.f;
+                ent_type gunEquiped = getGunEquipedEntity();
+                if (gunEquiped.id != -1) {
+                    commands.destroy(gunEquiped);
+                }
+
+                destroyLater(dave, body);
+                commands.call([this] { createDave(DAVE_START_COLUMN, DAVE_START_ROW); });
+            });
+
+        collisions.on(C::Dave, C::Gun, [this](ent_type dave, b2BodyId, ent_type gun, b2BodyId body) {
+            destroyLater(gun, body);
+
+            const ent_type gunEquipped = commands.create();
+            commands.addAll(gunEquipped,
+                Position{{0.5 * RED_BLOCK.w * BLOCK_TEX_SCALE, 11.5 * RED_BLOCK.h * BLOCK_TEX_SCALE}, 0},
+                Drawable{GUN, BLOCK_TEX_SCALE, true, false, true},
+                GunEquipedLabel{},
+                Hud{}
+            );
+
+            commands.add(dave, Gun{});
+            commands.add<LastShot>(dave, LastShot{});
+        });
+
+        // Dave's bullets kill monsters; any bullet stops at a wall
+        collisions.on(C::Bullet, {C::Monster, C::Ghost}, [this](ent_type bullet, b2BodyId, ent_type monster, b2BodyId body) {
+            parkBullet(bullet);
+            destroyLater(monster, body);
+        });
+        collisions.on(C::Bullet, C::Wall, [this](ent_type bullet, b2BodyId, ent_type, b2BodyId) { parkBullet(bullet); });
+        collisions.on(C::MonsterBullet, C::Wall, [this](ent_type bullet, b2BodyId, ent_type, b2BodyId) { parkBullet(bullet); });
+
+        collisions.on(C::Ghost, C::Wall, [](ent_type ghost, b2BodyId, ent_type wallEnt, b2BodyId) {
+            const auto& monsterPos = World::getComponent<Position>(ghost);
+            const auto& wallPos = World::getComponent<Position>(wallEnt);
+            const auto& wall = World::getComponent<Wall>(wallEnt);
+
+            // Check for side collision: measured from the wall's edges, since merged walls span many tiles
+            float dx = fabs(monsterPos.p.x - wallPos.p.x) - wall.size.x * BLOCK_TEX_SCALE / 2;
+            float dy = fabs(monsterPos.p.y - wallPos.p.y) - wall.size.y * BLOCK_TEX_SCALE / 2;
+
+            if (dx > dy) { // mostly side collision
+                auto& motion = World::getComponent<BackAndForthMotion>(ghost);
+                motion.direction.x *= -1; // flip horizontal direction
+            }
+        });
+    }
+
+    void DaveGame::step()
+    {
+        sampleInput();
+        frame.run();
+        ++frameCount;
+        if (dumpTimeline)
+            printTimeline();
+    }
+
+    /// @brief Fills stepKeys from the replay log, the script or the keyboard, and records them.
+    void DaveGame::sampleInput()
+    {
+        const uint64_t now = SDL_GetTicksNS();
+        const uint64_t frameMs = lastStepNS ? (now - lastStepNS) / SDL_NS_PER_MS : 0;
+        lastStepNS = now;
+
+        if (!replaying.next(stepKeys)) {
+            const bool* keys = scriptedKeys;
+            if (!headless) {
+                SDL_PumpEvents();
+                keys = SDL_GetKeyboardState(nullptr);
+            }
+            for (SDL_Scancode k : InputLog::KEYS)
+                stepKeys[k] = keys[k];
+        }
+        if (!recordPath.empty())
+            recording.record(stepKeys, static_cast<uint16_t>(std::min<uint64_t>(frameMs, UINT16_MAX)));
+    }
+
+    /// @brief Prints the last frame's schedule; '*' marks the critical path.
+    void DaveGame::printTimeline() const
+    {
+        std::vector<std::thread::id> threads{std::this_thread::get_id()};
+        int64_t total = 0, critical = 0;
+        for (const auto& s : frame.timeline()) {
+            total = std::max(total, s.end);
+            if (s.critical)
+                critical += s.end - s.begin;
+        }
+        cout << "frame " << frameCount << ": " << total / 1000 << " us, critical path "
+             << critical / 1000 << " us\n";
+        for (const auto& s : frame.timeline()) {
+            auto t = std::find(threads.begin(), threads.end(), s.thread);
+            if (t == threads.end())
+                t = threads.insert(t, s.thread);
+            cout << (s.critical ? "  * " : "    ") << std::left << std::setw(26) << s.name
+                 << "thread " << (t - threads.begin()) << std::right
+                 << std::setw(8) << s.begin / 1000 << " .." << std::setw(6) << s.end / 1000 << " us\n";
+        }
+    }
+
+    void SpriteBatch::begin(SDL_Texture* atlas)
+    {
+        m_atlas = atlas;
+        float w = 1, h = 1;
+        SDL_GetTextureSize(atlas, &w, &h);
+        m_invW = 1.f / w;
+        m_invH = 1.f / h;
+        m_vertices.clear();
+        m_indices.clear();
+    }
+
+    void SpriteBatch::add(const SDL_FRect& src, const SDL_FRect& dst, bool flip)
+    {
+        float u0 = src.x * m_invW, u1 = (src.x + src.w) * m_invW;
+        const float v0 = src.y * m_invH, v1 = (src.y + src.h) * m_invH;
+        if (flip)
+            std::swap(u0, u1);
+
+        const int base = static_cast<int>(m_vertices.size());
+        const SDL_FColor white = {1.f, 1.f, 1.f, 1.f};
+        m_vertices.push_back({{dst.x, dst.y}, white, {u0, v0}});
+        m_vertices.push_back({{dst.x + dst.w, dst.y}, white, {u1, v0}});
+        m_vertices.push_back({{dst.x + dst.w, dst.y + dst.h}, white, {u1, v1}});
+        m_vertices.push_back({{dst.x, dst.y + dst.h}, white, {u0, v1}});
+        for (int i : {0, 1, 2, 0, 2, 3})
+            m_indices.push_back(base + i);
+    }
+
+    void SpriteBatch::flush(SDL_Renderer* ren)
+    {
+        if (!m_indices.empty())
+            SDL_RenderGeometry(ren, m_atlas, m_vertices.data(), static_cast<int>(m_vertices.size()),
+                               m_indices.data(), static_cast<int>(m_indices.size()));
+        m_vertices.clear();
+        m_indices.clear();
+    }
+
+    void InputLog::record(const bool* keys, uint16_t frameMs)
+    {
+        uint8_t bits = 0;
+        for (size_t i = 0; i < std::size(KEYS); ++i)
+            bits |= keys[KEYS[i]] << i;
+        m_steps.push_back({bits, frameMs});
+    }
+
+    bool InputLog::next(bool* keys)
+    {
+        if (m_cursor == m_steps.size())
+            return false;
+        const Step& step = m_steps[m_cursor++];
+        for (size_t i = 0; i < std::size(KEYS); ++i)
+            keys[KEYS[i]] = step.keys >> i & 1;
+        return true;
+    }
+
+    bool InputLog::save(const std::string& path) const
+    {
+        std::ofstream out(path, std::ios::binary);
+        const uint32_t count = static_cast<uint32_t>(m_steps.size());
+        const unsigned char header[8] = {'D', 'R', 'E', 'C', uint8_t(count), uint8_t(count >> 8),
+                                         uint8_t(count >> 16), uint8_t(count >> 24)};
+        out.write(reinterpret_cast<const char*>(header), sizeof(header));
+        for (const Step& step : m_steps) {
+            const unsigned char bytes[3] = {step.keys, uint8_t(step.frameMs), uint8_t(step.frameMs >> 8)};
+            out.write(reinterpret_cast<const char*>(bytes), sizeof(bytes));
+        }
+        return out.good();
+    }
+
+    bool InputLog::load(const std::string& path)
+    {
+        std::ifstream in(path, std::ios::binary);
+        unsigned char header[8];
+        if (!in.read(reinterpret_cast<char*>(header), sizeof(header)) || memcmp(header, "DREC", 4) != 0)
+            return false;
+        const uint32_t count = header[4] | header[5] << 8 | header[6] << 16 | uint32_t(header[7]) << 24;
+        std::vector<Step> steps(count);
+        for (Step& step : steps) {
+            unsigned char bytes[3];
+            if (!in.read(reinterpret_cast<char*>(bytes), sizeof(bytes)))
+                return false;
+            step = {bytes[0], static_cast<uint16_t>(bytes[1] | bytes[2] << 8)};
+        }
+        m_steps.swap(steps);
+        m_cursor = 0;
+        return true;
+    }
+
+#ifndef NDEBUG
+    PhysicsOverlay::PhysicsOverlay() : m_draw(b2DefaultDebugDraw())
+    {
+        m_draw.DrawPolygonFcn = polygon;
+        m_draw.DrawSolidPolygonFcn = solidPolygon;
+        m_draw.DrawCircleFcn = circle;
+        m_draw.DrawSolidCircleFcn = solidCircle;
+        m_draw.DrawSegmentFcn = segment;
+        m_draw.drawShapes = true;
+        m_draw.useDrawingBounds = true;
+        m_draw.context = this;
+    }
+
+    void PhysicsOverlay::draw(b2WorldId world, const SDL_FRect& view, float pixelsPerMeter)
+    {
+        m_origin = {view.x, view.y};
+        m_scale = pixelsPerMeter;
+        // let Box2D's broadphase skip everything off screen
+        m_draw.drawingBounds = {
+            {view.x / pixelsPerMeter, view.y / pixelsPerMeter},
+            {(view.x + view.w) / pixelsPerMeter, (view.y + view.h) / pixelsPerMeter}
+        };
+        b2World_Draw(world, &m_draw);
+    }
+
+    void PhysicsOverlay::flush(SDL_Renderer* ren)
+    {
+        if (!m_indices.empty())
+            SDL_RenderGeometry(ren, nullptr, m_vertices.data(), static_cast<int>(m_vertices.size()),
+                               m_indices.data(), static_cast<int>(m_indices.size()));
+        m_vertices.clear();
+        m_indices.clear();
+    }
+
+    void PhysicsOverlay::polygon(const b2Vec2* vertices, int count, b2HexColor color, void* context)
+    {
+        auto* self = static_cast<PhysicsOverlay*>(context);
+        for (int i = 0, j = count - 1; i < count; j = i++)
+            self->line(vertices[j], vertices[i], color);
+    }
+
+    void PhysicsOverlay::solidPolygon(b2Transform xf, const b2Vec2* vertices, int count, float, b2HexColor color, void* context)
+    {
+        b2Vec2 world[B2_MAX_POLYGON_VERTICES];
+        for (int i = 0; i < count; ++i)
+            world[i] = b2TransformPoint(xf, vertices[i]);
+        polygon(world, count, color, context);
+    }
+
+    void PhysicsOverlay::circle(b2Vec2 center, float radius, b2HexColor color, void* context)
+    {
+        static constexpr int SEGMENTS = 16;
+        b2Vec2 points[SEGMENTS];
+        for (int i = 0; i < SEGMENTS; ++i) {
+            const float a = i * 2 * B2_PI / SEGMENTS;
+            points[i] = {center.x + radius * std::cos(a), center.y + radius * std::sin(a)};
+        }
+        polygon(points, SEGMENTS, color, context);
+    }
+
+    void PhysicsOverlay::solidCircle(b2Transform xf, float radius, b2HexColor color, void* context)
+    {
+        circle(xf.p, radius, color, context);
+    }
+
+    void PhysicsOverlay::segment(b2Vec2 p1, b2Vec2 p2, b2HexColor color, void* context)
+    {
+        static_cast<PhysicsOverlay*>(context)->line(p1, p2, color);
+    }
+
+    /// @brief Queues the segment p1-p2 (meters) as a quad one pixel wide.
+    void PhysicsOverlay::line(b2Vec2 p1, b2Vec2 p2, b2HexColor color)
+    {
+        const SDL_FPoint a = {p1.x * m_scale - m_origin.x, p1.y * m_scale - m_origin.y};
+        const SDL_FPoint b = {p2.x * m_scale - m_origin.x, p2.y * m_scale - m_origin.y};
+        const float len = std::hypot(b.x - a.x, b.y - a.y);
+        if (len == 0)
+            return;
+        const float nx = (a.y - b.y) / len * 0.5f, ny = (b.x - a.x) / len * 0.5f;
+        const SDL_FColor c = {((color >> 16) & 0xff) / 255.f, ((color >> 8) & 0xff) / 255.f, (color & 0xff) / 255.f, 1.f};
+
+        const int base = static_cast<int>(m_vertices.size());
+        m_vertices.push_back({{a.x + nx, a.y + ny}, c, {0, 0}});
+        m_vertices.push_back({{b.x + nx, b.y + ny}, c, {0, 0}});
+        m_vertices.push_back({{b.x - nx, b.y - ny}, c, {0, 0}});
+        m_vertices.push_back({{a.x - nx, a.y - ny}, c, {0, 0}});
+        for (int k : {0, 1, 2, 0, 2, 3})
+            m_indices.push_back(base + k);
+    }
+#endif
+
+    void CollisionTable::on(CollisionClass sensor, CollisionClass visitor, Handler handler)
+    {
+        m_handlers[index(sensor, visitor)] = std::move(handler);
+        m_partners[static_cast<size_t>(sensor)] |= bit(visitor);
+        m_partners[static_cast<size_t>(visitor)] |= bit(sensor);
+    }
+
+    void CollisionTable::on(CollisionClass sensor, std::initializer_list<CollisionClass> visitors, const Handler& handler)
+    {
+        for (CollisionClass visitor : visitors)
+            on(sensor, visitor, handler);
+    }
+
+    void CollisionTable::dispatch(CollisionClass sensorClass, ent_type sensor, b2BodyId sensorBody,
+                                  CollisionClass visitorClass, ent_type visitor, b2BodyId visitorBody) const
+    {
+        if (const Handler& handler = m_handlers[index(sensorClass, visitorClass)])
+            handler(sensor, sensorBody, visitor, visitorBody);
+    }
+
+    b2Filter CollisionTable::filter(CollisionClass c, bool sensor) const
+    {
+        b2Filter f = b2DefaultShapeDef().filter;
+        f.categoryBits = bit(c);
+        if (sensor)
+            f.maskBits = m_partners[static_cast<size_t>(c)];
+        return f;
+    }
+
+    void SpatialGrid::move(ent_type e, SDL_FPoint p)
+    {
+        const Key k = key(static_cast<int>(std::floor(p.x / m_cellSize)), static_cast<int>(std::floor(p.y / m_cellSize)));
+        if (e.id >= static_cast<id_type>(m_filing.size()))
+            m_filing.resize(e.id + 1);
+        Filing& f = m_filing[e.id];
+        if (f.filed) {
+            if (f.key == k && f.e == e)
+                return;
+            auto& old = m_cells[f.key];
+            old.erase(std::find_if(old.begin(), old.end(), [e](ent_type o) { return o.id == e.id; }));
+        }
+        m_cells[k].push_back(e);
+        f = {k, e, true};
+    }
+
+    void SpatialGrid::remove(ent_type e)
+    {
+        if (e.id >= static_cast<id_type>(m_filing.size()))
+            return;
+        Filing& f = m_filing[e.id];
+        if (!f.filed || !(f.e == e))
+            return;
+        auto& cell = m_cells[f.key];
+        cell.erase(std::find(cell.begin(), cell.end(), e));
+        f.filed = false;
+    }
+
+    void SpatialGrid::clear()
+    {
+        m_cells.clear();
+        m_filing.clear();
+    }
+
+    void SpatialGrid::query(const SDL_FRect& rect, std::vector<ent_type>& out) const
+    {
+        const int x0 = static_cast<int>(std::floor(rect.x / m_cellSize));
+        const int y0 = static_cast<int>(std::floor(rect.y / m_cellSize));
+        const int x1 = static_cast<int>(std::floor((rect.x + rect.w) / m_cellSize));
+        const int y1 = static_cast<int>(std::floor((rect.y + rect.h) / m_cellSize));
+        for (int cx = x0; cx <= x1; ++cx)
+            for (int cy = y0; cy <= y1; ++cy) {
+                const auto it = m_cells.find(key(cx, cy));
+                if (it != m_cells.end())
+                    out.insert(out.end(), it->second.begin(), it->second.end());
+            }
+    }
+
     void DaveGame::prepareBoxWorld()
     {
         b2WorldDef worldDef = b2DefaultWorldDef();
         worldDef.gravity = {0, 9.8};
+        worldDef.workerCount = boxTasks.workers();
+        worldDef.enqueueTask = TaskSystem::enqueueTask;
+        worldDef.finishTask = TaskSystem::finishTask;
+        worldDef.userTaskContext = &boxTasks;
         boxWorld = b2CreateWorld(&worldDef);
     }
 
@@ -131,42 +603,32 @@ namespace dave_game{
     /// Requires Control and Intent. Checks optional Gun and Jetpack components.
     void DaveGame::InputSystem()
     {
-        Mask required = MaskBuilder()
-                        .set<Input>()
-                        .set<Intent>()
-                        .set<Dave>()
-                        .build();
-
-        SDL_PumpEvents();
-        const bool* keys = SDL_GetKeyboardState(nullptr);
-        uint32_t now = SDL_GetTicks();
-
-        for (id_type id = 0; id <= World::maxId().id; ++id) {
-            ent_type e{id};
-            if (World::mask(e).test(required)) {
-                const auto& k = World::getComponent<Input>(e);
-                auto& in = World::getComponent<Intent>(e);
-                in.up = keys[k.up];
-                in.down = keys[k.down];
-                in.left = keys[k.left];
-                in.right = keys[k.right];
-
-                Drawable& d = World::getComponent<Drawable>(e);
-                if (in.left || in.right) {
-                    d.flip = in.left; // Flip sprite if moving left
-                }
+        const bool* keys = stepKeys;
+        uint32_t now = simTime();
+
+        World::view<Input, Intent, Dave>().each([&](ent_type e) {
+            const auto& k = World::getComponent<Input>(e);
+            auto& in = World::getComponent<Intent>(e);
+            in.up = keys[k.up];
+            in.down = keys[k.down];
+            in.left = keys[k.left];
+            in.right = keys[k.right];
+
+            Drawable& d = World::getComponent<Drawable>(e);
+            if (in.left || in.right) {
+                d.flip = in.left; // Flip sprite if moving left
+            }
 
-                if (keys[SDL_SCANCODE_SPACE] && World::mask(e).test(Component<Gun>::Bit)) {
-                    auto& lastShot = World::getComponent<LastShot>(e);
-                    if (now - lastShot.time >= DAVE_FIRE_COOLDOWN_MS) {
-                        const auto& pos = World::getComponent<Position>(e);
-                        bool facingLeft = d.flip;
-                        createBullet(pos.p, facingLeft);
-                        lastShot.time = now;
-                    }
+            if (keys[SDL_SCANCODE_SPACE] && World::mask(e).test(Component<Gun>::Bit)) {
+                auto& lastShot = World::getComponent<LastShot>(e);
+                if (now - lastShot.time >= DAVE_FIRE_COOLDOWN_MS) {
+                    const auto& pos = World::getComponent<Position>(e);
+                    bool facingLeft = d.flip;
+                    fireBullet(daveBullets, pos.p, facingLeft);
+                    lastShot.time = now;
                 }
             }
-        }
+        });
     }
 
     void DaveGame::MenuInputSystem() {
@@ -204,114 +666,118 @@ namespace dave_game{
     /// @brief Controls shooting of AI entities
     void DaveGame::ShooterSystem()
     {
-        uint32_t now = SDL_GetTicks();
-
-        Mask required = MaskBuilder()
-            .set<Gun>()
-            .set<Monster>()
-            .build();
-
-        for (ent_type e{0}; e.id <= World::maxId().id; ++e.id) {
-            if (!World::mask(e).test(required)) continue;
+        uint32_t now = simTime();
 
+        World::view<Gun, Monster>().each([&](ent_type e) {
             auto& pos = World::getComponent<Position>(e);
             auto& drawable = World::getComponent<Drawable>(e);
             auto& lastShot = World::getComponent<LastShot>(e);
 
             if (now - lastShot.time >= MONSTER_FIRE_COOLDOWN_MS) {
-                createMonsterBullet(pos.p, true);
+                fireBullet(monsterBullets, pos.p, true);
                 lastShot.time = now;
             }
-        }
+        });
     }
 
     /// @brief Controls movement of all entities with Position and Course.
     void DaveGame::MovementSystem()
     {
-        const uint32_t now = SDL_GetTicks();
+        const uint32_t now = simTime();
 
-        static const Mask mask = MaskBuilder()
-                   .set<Intent>()
-                   .set<Collider>()
-                   .set<Position>()
-                   .build();
+        World::view<Intent, Collider, Position>().each([&](ent_type e) {
+            auto& i = World::getComponent<Intent>(e);
+            const auto& c = World::getComponent<Collider>(e);
+            bool isDave = World::mask(e).test(Component<Dave>::Bit);
 
-        for (ent_type e{0}; e.id <= World::maxId().id; ++e.id) {
-            if (World::mask(e).test(mask)) {
-                auto& i = World::getComponent<Intent>(e);
-                const auto& c = World::getComponent<Collider>(e);
-                bool isDave = World::mask(e).test(Component<Dave>::Bit);
+            const auto& vel = b2Body_GetLinearVelocity(c.b);
 
-                const auto& vel = b2Body_GetLinearVelocity(c.b);
+            const float x = i.left ? -3.f : i.right ? 3.f : 0.f;
+            b2Body_SetLinearVelocity(c.b, {x,vel.y});
 
-                const float x = i.left ? -3.f : i.right ? 3.f : 0.f;
-                b2Body_SetLinearVelocity(c.b, {x,vel.y});
 
+            if (isDave) {
 
-                if (isDave) {
+                auto& anim = World::getComponent<Animation>(e);
+                auto& groundStatus = World::getComponent<GroundStatus>(e);
 
-                    auto& anim = World::getComponent<Animation>(e);
-                    auto& groundStatus = World::getComponent<GroundStatus>(e);
+                if (i.up && groundStatus.onGround && (now - groundStatus.lastLandedTime >= DAVE_JUMP_COOLDOWN_MS)) {
 
-                    if (i.up && groundStatus.onGround && (now - groundStatus.lastLandedTime >= DAVE_JUMP_COOLDOWN_MS)) {
+                    float jumpVelocity = 9.f;
+                    float mass = b2Body_GetMass(c.b);
+                    b2Vec2 impulse = {0.0f, -mass * jumpVelocity};
+                    b2Body_ApplyLinearImpulseToCenter(c.b, impulse, true);
+                    groundStatus.onGround = false;
+                }
 
-                        float jumpVelocity = 9.f;
-                        float mass = b2Body_GetMass(c.b);
-                        b2Vec2 impulse = {0.0f, -mass * jumpVelocity};
-                        b2Body_ApplyLinearImpulseToCenter(c.b, impulse, true);
-                        groundStatus.onGround = false;
+                if (vel.x >= -ANIMATION_VELOCITY_THRESHOLD && vel.x <= ANIMATION_VELOCITY_THRESHOLD && vel.y >= -ANIMATION_VELOCITY_THRESHOLD && vel.y <= ANIMATION_VELOCITY_THRESHOLD) {
+                    // If not moving, set to idle state
+                    if (anim.currentState != 0) {
+                        anim.currentState = 0; // IDLE
+                        anim.currentFrame = 0;
+                        //groundStatus.onGround = true;
                     }
 
-                    if (vel.x >= -ANIMATION_VELOCITY_THRESHOLD && vel.x <= ANIMATION_VELOCITY_THRESHOLD && vel.y >= -ANIMATION_VELOCITY_THRESHOLD && vel.y <= ANIMATION_VELOCITY_THRESHOLD) {
-                        // If not moving, set to idle state
-                        if (anim.currentState != 0) {
-                            anim.currentState = 0; // IDLE
-                            anim.currentFrame = 0;
-                            //groundStatus.onGround = true;
-                        }
-
-                    } else if (vel.y >= -ANIMATION_VELOCITY_THRESHOLD && vel.y <= ANIMATION_VELOCITY_THRESHOLD) {
-                        // If moving, set to walk state
-                        if (anim.currentState != 1) {
-                            anim.currentState = 1; // WALK
-                            anim.currentFrame = 0;
-                            //groundStatus.onGround = true;
-                        }
+                } else if (vel.y >= -ANIMATION_VELOCITY_THRESHOLD && vel.y <= ANIMATION_VELOCITY_THRESHOLD) {
+                    // If moving, set to walk state
+                    if (anim.currentState != 1) {
+                        anim.currentState = 1; // WALK
+                        anim.currentFrame = 0;
+                        //groundStatus.onGround = true;
                     }
-                    else {
-                        // If jumping or falling, set to jump state
-                        if (anim.currentState != 2) {
-                            anim.currentState = 2; // JUMP
-                            anim.currentFrame = 0;
-                            //groundStatus.onGround = false;
-                        }
+                }
+                else {
+                    // If jumping or falling, set to jump state
+                    if (anim.currentState != 2) {
+                        anim.currentState = 2; // JUMP
+                        anim.currentFrame = 0;
+                        //groundStatus.onGround = false;
                     }
                 }
             }
-        }
+        });
     }
 
     void DaveGame::renderGoThruTheDoor() {
-        static const Mask labelMask = MaskBuilder()
-                   .set<DoorLabel>()
-                   .build();
+        World::view<DoorLabel>().each([](ent_type e) {
+            auto& d = World::getComponent<Drawable>(e);
+            d.visible = true;
+        });
+
+        World::view<Door>().each([](ent_type e) {
+            auto& d = World::getComponent<Door>(e);
+            d.open=true;
+        });
+    }
 
-        for (ent_type e{0}; e.id <= World::maxId().id; ++e.id) {
-            if (World::mask(e).test(labelMask)) {
-                auto& d = World::getComponent<Drawable>(e);
-                d.visible = true;
+    /// @brief Retires moving entities that outlived their Lifetime or left their DespawnBounds.
+    /// Only bodies Box2D reports as moved this step are looked at; bullets go back to their ring.
+    void DaveGame::DespawnSystem()
+    {
+        const uint32_t now = simTime();
+        const b2BodyEvents events = b2World_GetBodyEvents(boxWorld);
+        std::vector<std::pair<ent_type, b2BodyId>> expired;
+        for (int i = 0; i < events.moveCount; ++i) {
+            const b2BodyMoveEvent& move = events.moveEvents[i];
+            const ent_type e = fromUserData(move.userData);
+            if (!World::alive(e))
+                continue;
+            const Mask& m = World::mask(e);
+            bool retire = m.test(Component<Lifetime>::Bit) && now >= World::getComponent<Lifetime>(e).until;
+            if (!retire && m.test(Component<DespawnBounds>::Bit)) {
+                const SDL_FRect& area = World::getComponent<DespawnBounds>(e).area;
+                const SDL_FPoint p = {move.transform.p.x * BOX_SCALE, move.transform.p.y * BOX_SCALE};
+                retire = !SDL_PointInRectFloat(&p, &area);
             }
+            if (retire)
+                expired.emplace_back(e, move.bodyId);
         }
 
-        static const Mask doorMask = MaskBuilder()
-           .set<Door>()
-           .build();
-
-        for (ent_type e{0}; e.id <= World::maxId().id; ++e.id) {
-            if (World::mask(e).test(doorMask)) {
-                auto& d = World::getComponent<Door>(e);
-                d.open=true;
-            }
+        for (const auto& [e, body] : expired) {
+            if (World::mask(e).test(Component<Bullet>::Bit))
+                parkBullet(e);
+            else
+                destroyLater(e, body);
         }
     }
 
@@ -319,141 +785,27 @@ namespace dave_game{
     {
         if (skipSensorEvents) return;
         const auto sensorEvents = b2World_GetSensorEvents(boxWorld);
+        leavingLevel = false;
 
         for(int i = 0 ; i < sensorEvents.beginCount ; i++)
         {
             b2BodyId sensor = b2Shape_GetBody(sensorEvents.beginEvents[i].sensorShapeId);
             b2BodyId visitor = b2Shape_GetBody(sensorEvents.beginEvents[i].visitorShapeId);
-            auto *visitorEntity = static_cast<ent_type*>(b2Body_GetUserData(visitor));
-            auto *sensorEntity = static_cast<ent_type*>(b2Body_GetUserData(sensor));
-
-
-            bool sensorIsDave = World::mask(*sensorEntity).test(Component<Dave>::Bit);
-            bool sensorIsBullet = World::mask(*sensorEntity).test(Component<Bullet>::Bit);
-            bool sensorBackAndForthEnt = World::mask(*sensorEntity).test(Component<BackAndForthMotion>::Bit);
-
-            bool visitorIsWall = World::mask(*visitorEntity).test(Component<Wall>::Bit);
-            bool visitorIsDiamond = World::mask(*visitorEntity).test(Component<Diamond>::Bit);
-            bool visitorIsDoor = World::mask(*visitorEntity).test(Component<Door>::Bit);
-            bool visitorIsTrophy = World::mask(*visitorEntity).test(Component<Trophy>::Bit);
-            bool visitorIsMoveScreen = World::mask(*visitorEntity).test(Component<MoveScreenSensor>::Bit);
-            bool visitorIsSpikes = World::mask(*visitorEntity).test(Component<Spikes>::Bit);
-            bool visitorIsMonster = World::mask(*visitorEntity).test(Component<Monster>::Bit);
-            bool visitorIsGun = World::mask(*visitorEntity).test(Component<Gun>::Bit);
-            bool visitorIsBullet = World::mask(*visitorEntity).test(Component<Bullet>::Bit);
-
-            if (sensorIsDave && visitorIsWall)
-            {
-                auto& davePos = World::getComponent<Position>(*sensorEntity);
-                auto& wallPos = World::getComponent<Position>(*visitorEntity);
-
-                float daveBottom = davePos.p.y + (DAVE_JUMPING.h * DAVE_TEX_SCALE / 2);
-                float wallTop = wallPos.p.y - (RED_BLOCK.h * BLOCK_TEX_SCALE / 2);
-
-                if (daveBottom <= wallTop + 8.f) {
-                    auto& groundStatus = World::getComponent<GroundStatus>(*sensorEntity);
-                    groundStatus.onGround = true;
-                    groundStatus.lastLandedTime = SDL_GetTicks();
-                }
-            }
-
-            else if (sensorIsDave && visitorIsDiamond) {
-                auto& diamond = World::getComponent<Diamond>(*visitorEntity);
-                gameInfo.score +=  diamond.value;
-                World::destroyEntity(*visitorEntity);
-                b2DestroyBody(visitor);
-            }
-            else if (sensorIsDave && visitorIsDoor) {
-                auto& door = World::getComponent<Door>(*visitorEntity);
-                if (door.open) {
-                    //levelAnimation();
-                    loadLevel(++gameInfo.level);
-                    std::cout << "finish load new level: " << std::endl;
-                    break;
-                }
-            }
-            else if (sensorIsDave && visitorIsTrophy) {
-                auto& trophy = World::getComponent<Trophy>(*visitorEntity);
-                gameInfo.score += trophy.value; // Increase score by 100 for collecting a trophy
-                World::destroyEntity(*visitorEntity);
-                b2DestroyBody(visitor);
-                renderGoThruTheDoor();
-            }
-            else if (sensorIsDave && visitorIsMoveScreen) {
-                auto& moveScreen = World::getComponent<MoveScreenSensor>(*visitorEntity);
-                int screen = gameInfo.screenOffset / 0.5f;
-                if (moveScreen.forward &&  moveScreen.col == screen) {
-                    gameInfo.screenOffset += .5f; // Move screen forward
-                } else if (!moveScreen.forward && moveScreen.col == screen - 1) {
-                    gameInfo.screenOffset -= .5f; // Move screen backward
-                }
-            }
-            else if (sensorIsDave && visitorIsSpikes || sensorIsDave && visitorIsMonster) {
-                gameInfo.lives--;
-                if (gameInfo.lives <= 0) {
-                    EndGame();
-                    break;// End game if no lives left
-                }
-
-                gameInfo.screenOffset = 0.f;
-                ent_type gunEquiped = getGunEquipedEntity();
-                if (gunEquiped.id != -1) {
-                    World::destroyEntity(gunEquiped);
-                }
-
-                World::destroyEntity(*sensorEntity);
-                b2DestroyBody(sensor);
-                createDave(DAVE_START_COLUMN, DAVE_START_ROW);
-                break;
-            }
-            else if (sensorIsDave && visitorIsGun) {
-                //auto& gun = World::getComponent<Gun>(*visitorEntity);
-                World::destroyEntity(*visitorEntity);
-                b2DestroyBody(visitor);
-
-                auto gunEquipped = Entity::create();
-                gunEquipped.addAll(
-                    Position{{0.5 * RED_BLOCK.w * BLOCK_TEX_SCALE, 11.5 * RED_BLOCK.h * BLOCK_TEX_SCALE}, 0},
-                    Drawable{GUN, BLOCK_TEX_SCALE, true, false, true},
-                    GunEquipedLabel{}
-                );
-
-                World::addComponent(*sensorEntity, Gun{});
-                World::addComponent<LastShot>(*sensorEntity, LastShot{});
-            }
-            else if (sensorIsBullet) {
-                if (visitorIsBullet) {
-                    continue;
-                }
-
-                bool bulletFromMonster = World::mask(*sensorEntity).test(Component<Monster>::Bit);
-                if (visitorIsMonster && !bulletFromMonster) {
-                    World::destroyEntity(*sensorEntity);
-                    World::destroyEntity(*visitorEntity);
-                    b2DestroyBody(sensor);
-                    b2DestroyBody(visitor);
-                    break;
-                }
-                if (visitorIsWall) {
-                    World::destroyEntity(*sensorEntity);
-                    b2DestroyBody(sensor);
-                    break;
-                }
-            }
-            else if (sensorBackAndForthEnt && visitorIsWall) {
-                const auto& monsterPos = World::getComponent<Position>(*sensorEntity);
-                const auto& wallPos = World::getComponent<Position>(*visitorEntity);
-
-                // Check for side collision (horizontal overlap, vertical alignment)
-                float dx = fabs(monsterPos.p.x - wallPos.p.x);
-                float dy = fabs(monsterPos.p.y - wallPos.p.y);
-
-                if (dx > dy) { // mostly side collision
-                    auto& motion = World::getComponent<BackAndForthMotion>(*sensorEntity);
-                    motion.direction.x *= -1; // flip horizontal direction
-                }
-            }
+            const ent_type visitorEntity = fromUserData(b2Body_GetUserData(visitor));
+            const ent_type sensorEntity = fromUserData(b2Body_GetUserData(sensor));
+            if (!World::alive(sensorEntity) || !World::alive(visitorEntity) ||
+                commands.destroying(sensorEntity) || commands.destroying(visitorEntity) ||
+                !b2Body_IsEnabled(sensor))
+                continue; // gone, or a bullet already parked earlier in this step
+
+            const CollisionClass sensorClass = World::getComponent<Collides>(sensorEntity).as;
+            if (leavingLevel && sensorClass == CollisionClass::Dave)
+                continue; // Dave died or left earlier in this step
+            collisions.dispatch(sensorClass, sensorEntity, sensor,
+                                World::getComponent<Collides>(visitorEntity).as, visitorEntity, visitor);
         }
+        commands.play();
+        updateGrid(); // files what play() created, e.g. a respawned Dave on a recycled id
     }
 
     /**
@@ -462,31 +814,34 @@ namespace dave_game{
 
     void DaveGame::box_system()
     {
-        static const Mask mask = MaskBuilder()
-            .set<Collider>()
-            .set<Position>()
-            .build();
         static constexpr float	BOX2D_STEP = 1.f/FPS;
+        World::each<PrevPosition, Position>([](ent_type, PrevPosition& prev, const Position& p) {
+            prev = {p.p, p.a};
+        });
         b2World_Step(boxWorld, BOX2D_STEP, 4);
 
-        for (ent_type e{0}; e.id <= World::maxId().id; ++e.id) {
-            if (World::mask(e).test(mask)) {
-                b2Transform t = b2Body_GetTransform(World::getComponent<Collider>(e).b);
-
-                auto & c = World::getComponent<Collider>(e);
-                b2BodyId body = c.b;
-                // Get Box2D center position (in meters)
-                b2Vec2 pos = b2Body_GetPosition(body);
-
-                // Convert to pixels
-                float centerX = pos.x * BOX_SCALE;
-                float centerY = pos.y * BOX_SCALE;
-                World::getComponent<Position>(e) = {
-                    {centerX, centerY},
-                    RAD_TO_DEG * b2Rot_GetAngle(t.q)
-                };
-            }
-        }
+        World::eachParallel<Collider, Position>([](ent_type, const Collider& c, Position& p) {
+            // Box2D center position (in meters)
+            b2Transform t = b2Body_GetTransform(c.b);
+
+            // Convert to pixels
+            p = {
+                {t.p.x * BOX_SCALE, t.p.y * BOX_SCALE},
+                RAD_TO_DEG * b2Rot_GetAngle(t.q)
+            };
+        });
+        updateGrid();
+    }
+
+    /// @brief Refiles moving sprites whose centre crossed into another tile; baked ones are never drawn one by one.
+    void DaveGame::updateGrid()
+    {
+        const Mask drawn = MaskBuilder().set<Drawable>().build();
+        World::each<Collider, Position>([this, &drawn](ent_type e, const Collider&, const Position& p) {
+            const Mask& m = World::mask(e);
+            if (m.test(drawn) && !m.test(Component<Baked>::Bit))
+                grid.move(e, p.p);
+        });
     }
 
     void DaveGame::loadLevel(int level) {
@@ -517,22 +872,31 @@ namespace dave_game{
             EndGame();
             return;
         }
+        createBullets();
+        bakeStaticLayer(); // once, after both the map and the status bar exist
+        updateGrid(); // so the level shows before its first step
     }
 
     void DaveGame::unloadLevel() {
         Mask required = MaskBuilder()
             .set<Collider>()
             .build();
-        for (id_type id = 0; id <= World::maxId().id; ++id) {
-            ent_type e{id};
+        std::vector<ent_type> ents;
+        std::vector<b2BodyId> bodies;
+        World::match(Mask{}, ents);
+        for (ent_type e : ents) {
             if (World::mask(e).test(required)) {
-                auto& c = World::getComponent<Collider>(e);
-                World::destroyEntity(e);
-                b2DestroyBody(c.b);
-            }else {
-                World::destroyEntity(e);
+                bodies.push_back(World::getComponent<Collider>(e).b);
             }
         }
+        World::destroyEntities(ents.data(), ents.size());
+        for (b2BodyId body : bodies) {
+            b2DestroyBody(body);
+        }
+        clearStaticLayer();
+        grid.clear();
+        daveBullets = {};
+        monsterBullets = {};
         cout<< "Unloaded level: " << gameInfo.level - 1 << endl;
     }
 
@@ -540,89 +904,91 @@ namespace dave_game{
         unloadLevel();
         createMap(&walkingMap[0][0], MAP_WIDTH, 5);
         createDave(0, 3);
+        bakeStaticLayer();
 
         const float tileWidth = RED_BLOCK.w * BLOCK_TEX_SCALE;
         const float finalX = (MAP_WIDTH - 2) * tileWidth;  // Last column in pixels
 
-        for (id_type i = 0; i <= World::maxId().id; ++i) {
-            ent_type e{i};
-            if (World::mask(e).test(Component<Dave>::Bit)) {
-                auto& pos = World::getComponent<Position>(e);
-                auto& in = World::getComponent<Intent>(e);
-                in.right = true;
-                bool end = false;
-                auto start = SDL_GetTicks();
-                while (!end) {
-                    // Update input, physics, movement, etc.
+        const View& daves = World::view<Dave>();
+        if (daves.size() > 0) {
+            ent_type e = daves[0];
+            auto& pos = World::getComponent<Position>(e);
+            auto& in = World::getComponent<Intent>(e);
+            in.right = true;
+            bool end = false;
+            FixedTimestep clock(STEP_NS, MAX_SUBSTEPS);
+            clock.reset();
+            while (!end) {
+                // Update input, physics, movement, etc.
+                for (int i = clock.advance(); i > 0; --i) {
                     MovementSystem();
                     box_system();
                     AnimationSystem();
-                    RenderSystem();
+                }
+                renderAlpha = clock.alpha();
+                RenderSystem();
 
-                    // Check Dave's current position
-                    if (pos.p.x >= finalX) {
-                        end = true; // Dave reached the last column
-                    }
+                // Check Dave's current position
+                if (pos.p.x >= finalX) {
+                    end = true; // Dave reached the last column
+                }
 
-                    SDL_Event e;
-                    while (SDL_PollEvent(&e)) {
-                        if (e.type == SDL_EVENT_QUIT)
-                            end = true;
-                        else if ((e.type == SDL_EVENT_KEY_DOWN) && (e.key.scancode == SDL_SCANCODE_ESCAPE))
-                            end = true;
-                    }
+                if (!vsync)
+                    SDL_DelayNS(clock.untilNextStep());
 
-                    auto end = SDL_GetTicks();
-                    if (end-start < GAME_FRAME) {
-                        SDL_Delay(GAME_FRAME - (end-start));
-                    }
-                    start += GAME_FRAME;
+                SDL_Event e;
+                while (SDL_PollEvent(&e)) {
+                    if (e.type == SDL_EVENT_QUIT)
+                        end = true;
+                    else if ((e.type == SDL_EVENT_KEY_DOWN) && (e.key.scancode == SDL_SCANCODE_ESCAPE))
+                        end = true;
                 }
-                break;
             }
         }
         unloadLevel(); // Clean up
     }
 
 
+    /// @brief Updates the score digits, level number and lives heads.
+    /// Labels are only touched when the value they show changed or they were just created.
     void DaveGame::StatusBarSystem() {
-        int score = gameInfo.score;
-        int digit = 0;
+        const auto showScore = [this](ent_type e) {
+            const auto& label = World::getComponent<ScoreLabel>(e);
+            int score = gameInfo.score;
+            for (int i = 0; i < label.power; ++i)
+                score /= 10;
+            auto& drawable = World::getComponent<Drawable>(e);
+            drawable.part = NUMBERS_SPRITES[score % 10].part;
+            World::markChanged<Drawable>(e);
+        };
+        const auto showLevel = [this](ent_type e) {
+            auto& drawable = World::getComponent<Drawable>(e);
+            drawable.part = NUMBERS_SPRITES[gameInfo.level].part;
+            World::markChanged<Drawable>(e);
+        };
+        const auto showLives = [this](ent_type e) {
+            auto& lh = World::getComponent<LivesHead>(e);
+            if (lh.index >= gameInfo.lives) {
+                World::destroyEntity(e);
+            }
+        };
 
-        static const Mask score_mask = MaskBuilder()
-            .set<ScoreLabel>()
-            .set<Drawable>()
-            .build();
+        if (gameInfo.score != shownInfo.score)
+            World::view<ScoreLabel, Drawable>().each(showScore);
+        else
+            World::eachChanged<ScoreLabel>(showScore);
 
-        static const Mask level_mask = MaskBuilder()
-            .set<LevelLabel>()
-            .set<Drawable>()
-            .build();
-        static const Mask Lives = MaskBuilder()
-            .set<LivesHead>()
-            .set<Drawable>()
-            .build();
+        if (gameInfo.level != shownInfo.level)
+            World::view<LevelLabel, Drawable>().each(showLevel);
+        else
+            World::eachChanged<LevelLabel>(showLevel);
 
-        for (id_type i =0; i <= World::maxId().id; ++i) {
-            ent_type e{i};
+        if (gameInfo.lives != shownInfo.lives)
+            World::view<LivesHead, Drawable>().each(showLives);
+        else
+            World::eachChanged<LivesHead>(showLives);
 
-            if (World::mask(e).test(score_mask)) {
-                digit = score % 10;
-                score /= 10;
-                auto& drawable = World::getComponent<Drawable>(e);
-                drawable.part = NUMBERS_SPRITES[digit].part;
-            }
-            else if (World::mask(e).test(level_mask)) {
-                auto& drawable = World::getComponent<Drawable>(e);
-                drawable.part = NUMBERS_SPRITES[gameInfo.level].part;
-            }
-            else if (World::mask(e).test(Lives)) {
-                auto& lh = World::getComponent<LivesHead>(e);
-                if (gameInfo.lives == lh.index) {
-                    World::destroyEntity(e);
-                }
-            }
-        }
+        shownInfo = gameInfo;
     }
 
 
@@ -635,113 +1001,152 @@ namespace dave_game{
             return;
         }
 
-        MaskBuilder builder;
-        builder.set<Position>().set<Drawable>();
-        Mask required = builder.build();
-
         SDL_RenderClear(ren);
 
-        for (int i = 0; i <= World::maxId().id; ++i)
+        for (size_t i = 0; i < levelChunks.size(); ++i) {
+            const SDL_FRect dst = {(i - gameInfo.screenOffset) * WIN_WIDTH, 0, WIN_WIDTH, WIN_HEIGHT};
+            if (dst.x < WIN_WIDTH && dst.x + WIN_WIDTH > 0)
+                SDL_RenderTexture(ren, levelChunks[i], nullptr, &dst);
+        }
+        if (hudLayer != nullptr)
+            SDL_RenderTexture(ren, hudLayer, nullptr, nullptr);
+
+        sprites.begin(tex);
+
+        const auto draw = [this](ent_type e)
         {
-            ent_type e{i};
-            if (!World::mask(e).test(required))
-            {
-                continue;
+            // blend between the last two physics steps by how far we are into the next one
+            Position pos = World::getComponent<Position>(e);
+            if (World::mask(e).test(Component<PrevPosition>::Bit)) {
+                const auto& prev = World::getComponent<PrevPosition>(e);
+                pos.p.x = prev.p.x + (pos.p.x - prev.p.x) * renderAlpha;
+                pos.p.y = prev.p.y + (pos.p.y - prev.p.y) * renderAlpha;
             }
-            //debug printing pyisic
-             if (World::mask(e).test(Component<Collider>::Bit))
-             {
-                 const Collider& collider = World::getComponent<Collider>(e);
-                 const auto& dr = World::getComponent<Drawable>(e);
-
-                     b2BodyId body = collider.b;
-
-                     // Get Box2D center position (in meters)
-                     b2Vec2 pos = b2Body_GetPosition(body);
-
-                     // Convert to pixels
-                     float centerX = pos.x * BOX_SCALE;
-                     float centerY = pos.y * BOX_SCALE;
-                     float w,h;
-                     if ( World::mask(e).test(Component<Wall>::Bit)) {///DEBUG
-                         const Wall& wall = World::getComponent<Wall>(e); // stores shape ID
-                         w = wall.size.x * BLOCK_TEX_SCALE;
-                         h = wall.size.y * BLOCK_TEX_SCALE;
-                     }else if ( World::mask(e).test(Component<Monster>::Bit)) {
-                         w = BAT_MONSTER_1.w * BLOCK_TEX_SCALE; // back to pixels
-                         h = BAT_MONSTER_1.h * BLOCK_TEX_SCALE;
-                     }
-                     else {
-                         w = DAVE_JUMPING.w * DAVE_TEX_SCALE; // back to pixels
-                         h = DAVE_JUMPING.h * DAVE_TEX_SCALE;
-                     }
-
-                     // Top-left corner
-                     SDL_FRect boxRect = {
-                         centerX - w/2 - (gameInfo.screenOffset * (!dr.isStatic) * WIN_WIDTH),
-                         centerY - h/2,
-                         w,
-                         h
-                     };
-                 SDL_SetRenderDrawColor(ren, 255, 0, 0, 255);
-                 SDL_RenderRect(ren, &boxRect);
-                 SDL_SetRenderDrawColor(ren, 0, 0, 0, 255);
-             }
-
-            const auto& pos = World::getComponent<Position>(e);
             const auto& drawable = World::getComponent<Drawable>(e);
 
             if (!drawable.visible)
             {
-                continue; // Skip rendering if not visible
+                return; // Skip rendering if not visible
             }
 
-            if (World::mask(e).test(Component<Wall>::Bit)) {
-                auto& wall = World::getComponent<Wall>(e);
-                const SDL_FRect dst = {
-                    pos.p.x - (wall.size.x * drawable.scale / 2) - (gameInfo.screenOffset * (!drawable.isStatic) * WIN_WIDTH),
-                    pos.p.y - (wall.size.y * drawable.scale / 2),
-                    drawable.part.w * drawable.scale,
-                    drawable.part.h * drawable.scale
-                };
-                int tilesNum = wall.size.x / RED_BLOCK.w ;
+            queueSprite(sprites, e, pos.p, gameInfo.screenOffset * (!drawable.isStatic) * WIN_WIDTH);
+        };
+
+        // only what the grid has filed around the window, in id order as the full view drew it
+        static constexpr float MARGIN = 2 * RED_BLOCK.w * BLOCK_TEX_SCALE;
+        const SDL_FRect window = {
+            gameInfo.screenOffset * WIN_WIDTH - MARGIN, -MARGIN,
+            WIN_WIDTH + 2 * MARGIN, WIN_HEIGHT + 2 * MARGIN
+        };
+        const Mask filed = MaskBuilder().set<Position>().set<Drawable>().set<Collider>().build();
+        visible.clear();
+        grid.query(window, visible);
+        std::sort(visible.begin(), visible.end(), [](ent_type a, ent_type b) { return a.id < b.id; });
+        for (ent_type e : visible)
+            if (World::alive(e) && World::mask(e).test(filed) && !World::mask(e).test(Component<Baked>::Bit))
+                draw(e);
+        World::view<Hud, Position, Drawable>().each(draw);
+        sprites.flush(ren);
+
+#ifndef NDEBUG
+        if (physicsOverlay.enabled) {
+            physicsOverlay.draw(boxWorld, {gameInfo.screenOffset * WIN_WIDTH, 0, WIN_WIDTH, WIN_HEIGHT}, BOX_SCALE);
+            physicsOverlay.flush(ren);
+        }
+#endif
+        SDL_RenderPresent(ren);
+    }
+
+    /// @brief Queues e's sprite (every tile, for walls) centred on p and shifted left by shiftX pixels.
+    void DaveGame::queueSprite(SpriteBatch& batch, ent_type e, SDL_FPoint p, float shiftX) const
+    {
+        const auto& drawable = World::getComponent<Drawable>(e);
+        if (World::mask(e).test(Component<Wall>::Bit)) {
+            const auto& wall = World::getComponent<Wall>(e);
+            const SDL_FRect dst = {
+                p.x - (wall.size.x * drawable.scale / 2) - shiftX,
+                p.y - (wall.size.y * drawable.scale / 2),
+                drawable.part.w * drawable.scale,
+                drawable.part.h * drawable.scale
+            };
+            int tilesNum = wall.size.x / RED_BLOCK.w ;
+            int rowsNum = wall.size.y / RED_BLOCK.h;
 
+            for (int r = 0; r < rowsNum; ++r)
                 for (int j = 0; j < tilesNum; ++j) {
                     SDL_FRect tileDst = dst;
                     tileDst.x += j * RED_BLOCK.w * BLOCK_TEX_SCALE;
-                    SDL_RenderTextureRotated(ren, tex, &drawable.part, &tileDst, 0, nullptr, SDL_FLIP_NONE);
+                    tileDst.y += r * RED_BLOCK.h * BLOCK_TEX_SCALE;
+                    batch.add(drawable.part, tileDst);
                 }
-            }
-            else {
+        }
+        else {
             const SDL_FRect dst = {
-                pos.p.x - (drawable.part.w * drawable.scale / 2) - (gameInfo.screenOffset * (!drawable.isStatic) * WIN_WIDTH),
-                pos.p.y - (drawable.part.h * drawable.scale / 2),
+                p.x - (drawable.part.w * drawable.scale / 2) - shiftX,
+                p.y - (drawable.part.h * drawable.scale / 2),
                 drawable.part.w * drawable.scale,
                 drawable.part.h * drawable.scale
             };
+            batch.add(drawable.part, dst, drawable.flip);
+        }
+    }
 
-            SDL_FlipMode flip = drawable.flip ? SDL_FLIP_HORIZONTAL : SDL_FLIP_NONE;
+    /// @brief Draws every Baked entity once: level sprites into screen-width chunk textures
+    /// (scrolled by RenderSystem), status bar titles into a fixed screen-sized one.
+    void DaveGame::bakeStaticLayer()
+    {
+        clearStaticLayer();
+        if (ren == nullptr)
+            return;
 
-            SDL_RenderTextureRotated(
-                ren, tex, &drawable.part, &dst, 0,
-                nullptr, flip);
-            }
-        }
-        SDL_RenderPresent(ren);
+        float right = 0;
+        World::view<Baked, Position, Drawable>().each([&right](ent_type e) {
+            if (!World::getComponent<Drawable>(e).isStatic)
+                right = std::max(right, World::getComponent<Position>(e).p.x);
+        });
+
+        const auto bake = [this](bool hud, float shiftX) {
+            SDL_Texture* target = SDL_CreateTexture(ren, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET,
+                                                    WIN_WIDTH, WIN_HEIGHT);
+            SDL_SetTextureBlendMode(target, SDL_BLENDMODE_BLEND);
+            SDL_SetRenderTarget(ren, target);
+            SDL_SetRenderDrawColor(ren, 0, 0, 0, 0);
+            SDL_RenderClear(ren);
+
+            SpriteBatch batch;
+            batch.begin(tex);
+            World::view<Baked, Position, Drawable>().each([&](ent_type e) {
+                const auto& drawable = World::getComponent<Drawable>(e);
+                if (drawable.visible && drawable.isStatic == hud)
+                    queueSprite(batch, e, World::getComponent<Position>(e).p, shiftX);
+            });
+            batch.flush(ren);
+
+            SDL_SetRenderTarget(ren, nullptr);
+            SDL_SetRenderDrawColor(ren, 0, 0, 0, 255);
+            return target;
+        };
+
+        for (int chunk = 0; chunk * WIN_WIDTH <= right; ++chunk)
+            levelChunks.push_back(bake(false, chunk * WIN_WIDTH));
+        hudLayer = bake(true, 0);
     }
 
-    void DaveGame::CircularMotionSystem()
+    void DaveGame::clearStaticLayer()
     {
-        static const Mask mask = MaskBuilder()
-            .set<CircularMotion>()
-            .set<Collider>()
-            .build();
+        for (SDL_Texture* chunk : levelChunks)
+            SDL_DestroyTexture(chunk);
+        levelChunks.clear();
+        if (hudLayer != nullptr)
+            SDL_DestroyTexture(hudLayer);
+        hudLayer = nullptr;
+    }
 
+    void DaveGame::CircularMotionSystem()
+    {
         float dt = PHYSICS_TIME_STEP; // seconds per frame
 
-        for (ent_type e{0}; e.id <= World::maxId().id; ++e.id) {
-            if (!World::mask(e).test(mask)) continue;
-
+        World::view<CircularMotion, Collider>().each([dt](ent_type e) {
             auto& motion = World::getComponent<CircularMotion>(e);
             auto& col = World::getComponent<Collider>(e);
 
@@ -753,7 +1158,7 @@ namespace dave_game{
 
             b2Body_SetTransform(col.b, {newX / BOX_SCALE, newY / BOX_SCALE}, b2MakeRot(0.0f));
 
-        }
+        });
     }
 
 
@@ -769,19 +1174,8 @@ namespace dave_game{
         if (frameCounter < ANIMATION_INTERVAL) return;
 
 
-        MaskBuilder builder;
-        builder.set<Animation>().set<Drawable>();
-        Mask required = builder.build();
-
-        for (int i = 0; i <= World::maxId().id; ++i)
+        World::view<Animation, Drawable>().each([](ent_type e)
         {
-            ent_type e{i};
-            if (!World::mask(e).test(required))
-            {
-                continue;
-            }
-
-
             auto& anim = World::getComponent<Animation>(e);
             auto& sprite = World::getComponent<Drawable>(e);
             auto flip = sprite.flip;
@@ -791,7 +1185,8 @@ namespace dave_game{
 
             anim.currentFrame++;
             anim.currentFrame %= anim.framesCount;
-        }
+            World::markChanged<Drawable>(e);
+        });
 
         frameCounter = 0;
     }
@@ -822,6 +1217,9 @@ namespace dave_game{
 
 
     b2ShapeDef daveShapeDef = b2DefaultShapeDef();
+
+
+    daveShapeDef.filter = collisions.filter(CollisionClass::Dave, false);
     daveShapeDef.density = 20.f;
     daveShapeDef.enableSensorEvents = false;
     daveShapeDef.isSensor = false;
@@ -847,6 +1245,7 @@ namespace dave_game{
 
     // Optional sensor shape (e.g., for ground detection)
     b2ShapeDef daveShapeDef2 = b2DefaultShapeDef();
+    daveShapeDef2.filter = collisions.filter(CollisionClass::Dave, true);
     daveShapeDef2.enableSensorEvents = true;
     daveShapeDef2.isSensor = true;
 
@@ -881,8 +1280,10 @@ namespace dave_game{
     Entity e = Entity::create();
     e.addAll(
         Position{center, 0},
+        PrevPosition{center, 0},
         Drawable{DAVE_STANDING, DAVE_TEX_SCALE, true, false},
         Collider{daveBody},
+        Collides{CollisionClass::Dave},
         Intent{},
         Animation{DAVE_ANIMATION, 1, 4, 0, 0, Animation::Type::DAVE},
         Input{SDL_SCANCODE_UP, SDL_SCANCODE_DOWN, SDL_SCANCODE_RIGHT, SDL_SCANCODE_LEFT},
@@ -890,36 +1291,46 @@ namespace dave_game{
         GroundStatus{true}
     );
 
-    b2Body_SetUserData(daveBody, new ent_type{e.entity()});
+    b2Body_SetUserData(daveBody, toUserData(e.entity()));
     std::cout << "Dave entity created with ID: " << e.entity().id << std::endl;
     }
 
 
+    /// @brief Builds a level from its tile grid. Red blocks are greedy-meshed into as few wall
+    /// rectangles as possible and each run of spikes shares one body; sky and sand get none.
     void DaveGame::createMap(uint8_t* map, int width, int height) {
+        levelBounds = {0, 0, width * RED_BLOCK.w * BLOCK_TEX_SCALE, (height + 1) * RED_BLOCK.h * BLOCK_TEX_SCALE};
+        std::vector<bool> meshed(width * height, false);
+        const auto solid = [&](int row, int col) {
+            return map[row * width + col] == GRID_RED_BLOCK && !meshed[row * width + col];
+        };
+
         for (int row = 0; row < height; ++row) {
-            int wallStartCol = -1;
             for (int col = 0; col < width; ++col) {
                 int row_to_print = row + 1; // Offset by 1 to account for the status bar
                 uint8_t* map_row = (map + row * width);
                 if (map_row[col] == GRID_RED_BLOCK) {
-                    if (wallStartCol == -1) {
-                        wallStartCol = col;  // start of new wall segment
+                    if (!solid(row, col))
+                        continue; // already inside an earlier wall
+
+                    // widest run from here, then as many rows below as are solid across all of it
+                    int runWidth = 1;
+                    while (col + runWidth < width && solid(row, col + runWidth))
+                        ++runWidth;
+                    int runHeight = 1;
+                    while (row + runHeight < height) {
+                        int c = 0;
+                        while (c < runWidth && solid(row + runHeight, col + c))
+                            ++c;
+                        if (c < runWidth)
+                            break;
+                        ++runHeight;
                     }
-                    if (col + 1 >= width || map_row[col+1] != GRID_RED_BLOCK) {
-                        // end of a wall segment
-                        int wallEndCol = col;  // exclusive
-
-                        float wallWidth = ((wallEndCol - wallStartCol) + 1)* RED_BLOCK.w ;
-                        float wallHeight = RED_BLOCK.h;
+                    for (int r = row; r < row + runHeight; ++r)
+                        std::fill_n(meshed.begin() + r * width + col, runWidth, true);
 
-                        SDL_FPoint p = {(wallStartCol * RED_BLOCK.w * BLOCK_TEX_SCALE), row_to_print * RED_BLOCK.h * BLOCK_TEX_SCALE};
-                        createWall(p, wallWidth, wallHeight);
-                        wallStartCol = -1;
-
-                    }
-
-                    //SDL_FPoint p = {(col * RED_BLOCK.w * BLOCK_TEX_SCALE), row_to_print * RED_BLOCK.h * BLOCK_TEX_SCALE};
-                    //createWall(p,RED_BLOCK.w,RED_BLOCK.h);
+                    SDL_FPoint p = {(col * RED_BLOCK.w * BLOCK_TEX_SCALE), row_to_print * RED_BLOCK.h * BLOCK_TEX_SCALE};
+                    createWall(p, runWidth * RED_BLOCK.w, runHeight * RED_BLOCK.h);
                 }
                 else if (map_row[col] == GRID_DIAMOND) {
                     SDL_FPoint p = {col * RED_BLOCK.w * BLOCK_TEX_SCALE, row_to_print * RED_BLOCK.h * BLOCK_TEX_SCALE};
@@ -942,8 +1353,13 @@ namespace dave_game{
                     createMoveScreenSensor(p, true, col/20);
                 }
                 else if (map_row[col] == GRID_SPIKES) {
+                    if (col > 0 && map_row[col - 1] == GRID_SPIKES)
+                        continue; // part of the run started to the left
+                    int run = 1;
+                    while (col + run < width && map_row[col + run] == GRID_SPIKES)
+                        ++run;
                     SDL_FPoint p = {col * RED_BLOCK.w * BLOCK_TEX_SCALE, row_to_print * RED_BLOCK.h * BLOCK_TEX_SCALE};
-                    createSpikes(p);
+                    createSpikes(p, run);
                 }else if (map_row[col] == GRID_SKY) {
                     SDL_FPoint p = {col * RED_BLOCK.w * BLOCK_TEX_SCALE, row_to_print * RED_BLOCK.h * BLOCK_TEX_SCALE};
                     createBlock(p, SKY);
@@ -982,6 +1398,9 @@ namespace dave_game{
 
 
     b2ShapeDef mushroomShapeDef = b2DefaultShapeDef();
+
+
+    mushroomShapeDef.filter = collisions.filter(CollisionClass::Monster, false);
     mushroomShapeDef.density = 20.f;
     mushroomShapeDef.enableSensorEvents = true;
     b2SurfaceMaterial mat = {
@@ -1014,13 +1433,15 @@ namespace dave_game{
     Entity e = Entity::create();
     e.addAll(
         Position{center, 0},
+        PrevPosition{center, 0},
         Drawable{MUSHROOM1, BLOCK_TEX_SCALE, true, false},
         Collider{mushroomBody},
+        Collides{CollisionClass::Monster},
         Monster{},
         Animation{MUSHROOM_ANIMATION, 1, 8, 0, 0, Animation::Type::MUSHROOM}
     );
 
-    b2Body_SetUserData(mushroomBody, new ent_type{e.entity()});
+    b2Body_SetUserData(mushroomBody, toUserData(e.entity()));
     std::cout << "Mushroom entity created with ID: " << e.entity().id << std::endl;
     }
 
@@ -1047,6 +1468,9 @@ namespace dave_game{
 
 
     b2ShapeDef ghostShapeDef = b2DefaultShapeDef();
+
+
+    ghostShapeDef.filter = collisions.filter(CollisionClass::Ghost, true);
     ghostShapeDef.density = 20.f;
     ghostShapeDef.enableSensorEvents = true;
     ghostShapeDef.isSensor = true;
@@ -1074,40 +1498,32 @@ namespace dave_game{
     Entity e = Entity::create();
     e.addAll(
         Position{center, 0},
+        PrevPosition{center, 0},
         Drawable{GHOST1, BLOCK_TEX_SCALE, true, false},
         Collider{ghostBody},
+        Collides{CollisionClass::Ghost},
         Monster{},
         Animation{GHOST_ANIMATION, 1, 2, 0, 0, Animation::Type::GHOST},
         BackAndForthMotion{{1.f, 0.f}, 60.f}
     );
 
-    b2Body_SetUserData(ghostBody, new ent_type{e.entity()});
+    b2Body_SetUserData(ghostBody, toUserData(e.entity()));
     std::cout << "GHOST entity created with ID: " << e.entity().id << std::endl;
     }
 
+    /// @brief Decorative tile r at p; nothing collides with it, so it gets no body.
     void DaveGame::createBlock(SDL_FPoint p,SDL_FRect r) {
         SDL_FPoint center = {
             p.x + r.w * BLOCK_TEX_SCALE / 2.0f,
             p.y + r.h * BLOCK_TEX_SCALE / 2.0f
         };
-        b2BodyDef spikeBodyDef = b2DefaultBodyDef();
-        spikeBodyDef.type = b2_staticBody;
-        spikeBodyDef.position = {center.x / BOX_SCALE, center.y / BOX_SCALE};
-        b2BodyId blockBody = b2CreateBody(boxWorld, &spikeBodyDef);
-
-        b2ShapeDef blockShapeDef = b2DefaultShapeDef();
-        blockShapeDef.enableSensorEvents = true;
-
-        b2Polygon blockBox = b2MakeBox((DIAMOND.w*BLOCK_TEX_SCALE/BOX_SCALE)/2, (DIAMOND.h*BLOCK_TEX_SCALE/BOX_SCALE)/2);
-        b2CreatePolygonShape(blockBody, &blockShapeDef, &blockBox);
 
         Entity ent = Entity::create();
         ent.addAll(
             Position{center, 0},
             Drawable{r, BLOCK_TEX_SCALE, true, false},
-            Collider{blockBody}
+            Baked{}
             );
-        b2Body_SetUserData(blockBody, new ent_type{ent.entity()});
         std::cout << "BLock entity created with ID: " << ent.entity().id << std::endl;
     }
 
@@ -1125,6 +1541,8 @@ namespace dave_game{
         b2BodyId wallBody = b2CreateBody(boxWorld, &wallBodyDef);
 
         b2ShapeDef shapeDef = b2DefaultShapeDef();
+
+        shapeDef.filter = collisions.filter(CollisionClass::Wall, false);
         shapeDef.enableSensorEvents = true;
 
         b2SurfaceMaterial wallMat = {
@@ -1142,19 +1560,22 @@ namespace dave_game{
 
         Entity e = Entity::create();
         e.addAll(
-            Position{{}, 0},  // Still use top-left for rendering if needed
+            Position{center, 0},
             Collider{wallBody},
+            Collides{CollisionClass::Wall},
             Wall{shape, {width, height}},
-            Drawable{RED_BLOCK, BLOCK_TEX_SCALE, true, false}
+            Drawable{RED_BLOCK, BLOCK_TEX_SCALE, true, false},
+            Baked{}
         );
-        b2Body_SetUserData(wallBody, new ent_type{e.entity()});
+        b2Body_SetUserData(wallBody, toUserData(e.entity()));
         std::cout << "Wall entity created with ID: " << e.entity().id << std::endl;
 
     }
 
-    void DaveGame::createSpikes(SDL_FPoint p) {
+    /// @brief A run of count spike tiles starting at p: one hazard body, plus a body-less sprite per tile.
+    void DaveGame::createSpikes(SDL_FPoint p, int count) {
         SDL_FPoint center = {
-            p.x + SPIKES.w * BLOCK_TEX_SCALE / 2.0f,
+            p.x + count * SPIKES.w * BLOCK_TEX_SCALE / 2.0f,
             p.y + SPIKES.h * BLOCK_TEX_SCALE / 2.0f
         };
         b2BodyDef spikeBodyDef = b2DefaultBodyDef();
@@ -1163,20 +1584,25 @@ namespace dave_game{
         b2BodyId spikeBody = b2CreateBody(boxWorld, &spikeBodyDef);
 
         b2ShapeDef spikeShapeDef = b2DefaultShapeDef();
+
+        spikeShapeDef.filter = collisions.filter(CollisionClass::Spikes, false);
         spikeShapeDef.enableSensorEvents = true;
 
-        b2Polygon spikeBox = b2MakeBox((DIAMOND.w*BLOCK_TEX_SCALE/BOX_SCALE)/2, (DIAMOND.h*BLOCK_TEX_SCALE/BOX_SCALE)/2);
+        b2Polygon spikeBox = b2MakeBox((count*DIAMOND.w*BLOCK_TEX_SCALE/BOX_SCALE)/2, (DIAMOND.h*BLOCK_TEX_SCALE/BOX_SCALE)/2);
         b2CreatePolygonShape(spikeBody, &spikeShapeDef, &spikeBox);
 
         Entity ent = Entity::create();
         ent.addAll(
             Position{center, 0},
-            Drawable{SPIKES, BLOCK_TEX_SCALE, true, false},
             Collider{spikeBody},
+            Collides{CollisionClass::Spikes},
             Spikes{}
         );
-        b2Body_SetUserData(spikeBody, new ent_type{ent.entity()});
+        b2Body_SetUserData(spikeBody, toUserData(ent.entity()));
         std::cout << "Spikes entity created with ID: " << ent.entity().id << std::endl;
+
+        for (int i = 0; i < count; ++i)
+            createBlock({p.x + i * SPIKES.w * BLOCK_TEX_SCALE, p.y}, SPIKES);
     }
 
     void DaveGame::createDiamond(SDL_FPoint p) {
@@ -1191,6 +1617,8 @@ namespace dave_game{
         b2BodyId diamondBody = b2CreateBody(boxWorld, &diamondBodyDef);
 
         b2ShapeDef diamondShapeDef = b2DefaultShapeDef();
+
+        diamondShapeDef.filter = collisions.filter(CollisionClass::Diamond, false);
         diamondShapeDef.enableSensorEvents = true;
 
         b2Polygon diamondBox = b2MakeBox((DIAMOND.w*BLOCK_TEX_SCALE/BOX_SCALE)/2, (DIAMOND.h*BLOCK_TEX_SCALE/BOX_SCALE)/2);
@@ -1201,9 +1629,10 @@ namespace dave_game{
             Position{center, 0},
             Drawable{DIAMOND, BLOCK_TEX_SCALE, true, false},
             Collider{diamondBody},
+            Collides{CollisionClass::Diamond},
             Diamond{}
         );
-        b2Body_SetUserData(diamondBody, new ent_type{diamond.entity()});
+        b2Body_SetUserData(diamondBody, toUserData(diamond.entity()));
         std::cout << "Diamond entity created with ID: " << diamond.entity().id << std::endl;
     }
 
@@ -1220,6 +1649,8 @@ namespace dave_game{
         b2BodyId trophyBody = b2CreateBody(boxWorld, &trophyBodyDef);
 
         b2ShapeDef trophyShapeDef = b2DefaultShapeDef();
+
+        trophyShapeDef.filter = collisions.filter(CollisionClass::Trophy, false);
         trophyShapeDef.enableSensorEvents = true;
 
         b2Polygon diamondBox = b2MakeBox((TROPHY.w*BLOCK_TEX_SCALE/BOX_SCALE)/2, (TROPHY.h*BLOCK_TEX_SCALE/BOX_SCALE)/2);
@@ -1231,9 +1662,10 @@ namespace dave_game{
             Position{center, 0},
             Drawable{TROPHY, BLOCK_TEX_SCALE, true, false},
             Collider{trophyBody},
+            Collides{CollisionClass::Trophy},
             Trophy{}
         );
-        b2Body_SetUserData(trophyBody, new ent_type{trophy.entity()});
+        b2Body_SetUserData(trophyBody, toUserData(trophy.entity()));
         std::cout << "Trophy entity created with ID: " << trophy.entity().id << std::endl;
     }
 
@@ -1250,6 +1682,8 @@ namespace dave_game{
         b2BodyId doorBody = b2CreateBody(boxWorld, &doorBodyDef);
 
         b2ShapeDef doorShapeDef = b2DefaultShapeDef();
+
+        doorShapeDef.filter = collisions.filter(CollisionClass::Door, false);
         doorShapeDef.enableSensorEvents = true;
         //doorShapeDef.isSensor = true;
 
@@ -1261,9 +1695,10 @@ namespace dave_game{
             Position{center, 0},
             Drawable{DOOR, BLOCK_TEX_SCALE, true, false},
             Collider{doorBody},
+            Collides{CollisionClass::Door},
             Door{}
         );
-        b2Body_SetUserData(doorBody, new ent_type{door.entity()});
+        b2Body_SetUserData(doorBody, toUserData(door.entity()));
         std::cout << "Door entity created with ID: " << door.entity().id << std::endl;
     }
 
@@ -1280,6 +1715,8 @@ namespace dave_game{
         b2BodyId sensorBody = b2CreateBody(boxWorld, &sensorBodyDef);
 
         b2ShapeDef sensorShapeDef = b2DefaultShapeDef();
+
+        sensorShapeDef.filter = collisions.filter(CollisionClass::MoveScreen, true);
         sensorShapeDef.enableSensorEvents = true;
         sensorShapeDef.isSensor = true;
 
@@ -1291,9 +1728,10 @@ namespace dave_game{
         ent.addAll(
             Position{center, 0},
             Collider{sensorBody},
+            Collides{CollisionClass::MoveScreen},
             MoveScreenSensor{forward, col}
         );
-        b2Body_SetUserData(sensorBody, new ent_type{ent.entity()});
+        b2Body_SetUserData(sensorBody, toUserData(ent.entity()));
         std::cout << "Sensor entity created with ID: " << ent.entity().id << std::endl;
 
     }
@@ -1303,7 +1741,6 @@ namespace dave_game{
         createTitles();
         createScoreBar();
         createLevelAndHealth();
-
     }
 
     void DaveGame::createTitles() {
@@ -1311,7 +1748,8 @@ namespace dave_game{
         auto score = Entity::create();
         score.addAll(
             Position{{2 * RED_BLOCK.w * BLOCK_TEX_SCALE, 35}, 0},
-            Drawable{SCORE_SPRITE, BLOCK_TEX_SCALE, true, false, true}
+            Drawable{SCORE_SPRITE, BLOCK_TEX_SCALE, true, false, true},
+            Baked{}
         );
         std::cout << "Score label entity created with ID: " << score.entity().id << std::endl;
 
@@ -1319,20 +1757,23 @@ namespace dave_game{
         auto level = Entity::create();
         level.addAll(
             Position{{9 * RED_BLOCK.w * BLOCK_TEX_SCALE, 35}, 0},
-            Drawable{LEVEL_SPRITE, BLOCK_TEX_SCALE, true, false, true}
+            Drawable{LEVEL_SPRITE, BLOCK_TEX_SCALE, true, false, true},
+            Baked{}
         );
 
         auto daves = Entity::create();
         daves.addAll(
             Position{{13 * RED_BLOCK.w * BLOCK_TEX_SCALE, 35}, 0},
-            Drawable{HEALTH_SPRITE, BLOCK_TEX_SCALE, true, false, true}
+            Drawable{HEALTH_SPRITE, BLOCK_TEX_SCALE, true, false, true},
+            Baked{}
         );
 
         auto openDoor = Entity::create();
         openDoor.addAll(
             Position{{WIN_WIDTH/2, (12 * RED_BLOCK.h * BLOCK_TEX_SCALE) - (RED_BLOCK.h / 2) * BLOCK_TEX_SCALE}, 0},
             Drawable{{1084, 37, 1496, 118}, BLOCK_TEX_SCALE, false, false, true},
-            DoorLabel{}
+            DoorLabel{},
+            Hud{}
         );
     }
 
@@ -1343,7 +1784,8 @@ namespace dave_game{
             entity.addAll(
                 Position{{(i+1) * 40.f + 210, 35}, 0},
                 Drawable{NUMBERS_SPRITES[i+5]},
-                ScoreLabel{}
+                ScoreLabel{SCORE_DIGITS_COUNT - 1 - i},
+                Hud{}
             );
         }
 
@@ -1355,7 +1797,8 @@ namespace dave_game{
         level.addAll(
             Position{{700, 35}, 0},
             Drawable{NUMBERS_SPRITES[0]},
-            LevelLabel{}
+            LevelLabel{},
+            Hud{}
         );
         cout << "Created level icon" <<  level.entity().id <<endl;
 
@@ -1363,21 +1806,24 @@ namespace dave_game{
         health1.addAll(
             Position{{1020, 35}, 0},
             Drawable{DAVE_HEALTH, BLOCK_TEX_SCALE, true, false, true},
-            LivesHead{0}
+            LivesHead{0},
+            Hud{}
         );
         cout << "Created health icon" <<  health1.entity().id <<endl;
         Entity health2 = Entity::create();
         health2.addAll(
             Position{{1070, 35}, 0},
             Drawable{DAVE_HEALTH, BLOCK_TEX_SCALE, true, false, true},
-            LivesHead{1}
+            LivesHead{1},
+            Hud{}
         );
         cout << "Created health icon" <<  health2.entity().id <<endl;
         Entity health3 = Entity::create();
         health3.addAll(
             Position{{1120, 35}, 0},
             Drawable{DAVE_HEALTH, BLOCK_TEX_SCALE, true, false, true},
-            LivesHead{2}
+            LivesHead{2},
+            Hud{}
         );
         cout << "Created health icon" <<  health3.entity().id <<endl;
     }
@@ -1394,6 +1840,8 @@ namespace dave_game{
         b2BodyId gunBody = b2CreateBody(boxWorld, &gunBodyDef);
 
         b2ShapeDef gunShapeDef = b2DefaultShapeDef();
+
+        gunShapeDef.filter = collisions.filter(CollisionClass::Gun, false);
         gunShapeDef.enableSensorEvents = true;
 
         b2Polygon gunBox = b2MakeBox((GUN.w*BLOCK_TEX_SCALE/BOX_SCALE)/2, (GUN.h*BLOCK_TEX_SCALE/BOX_SCALE)/2);
@@ -1404,86 +1852,89 @@ namespace dave_game{
             Position{center, 0},
             Drawable{GUN, BLOCK_TEX_SCALE, true, false},
             Collider{gunBody},
+            Collides{CollisionClass::Gun},
             Gun{}
         );
-        b2Body_SetUserData(gunBody, new ent_type{gun.entity()});
+        b2Body_SetUserData(gunBody, toUserData(gun.entity()));
     }
 
-    void DaveGame::createBullet(SDL_FPoint davePos, bool goingLeft) {
-
-        constexpr float bulletSpeed = 8.f;
-
-        SDL_FPoint center = {
-            davePos.x + (goingLeft ? -BULLET.w : BULLET.w),
-            davePos.y
-        };
+    /// @brief Fills both bullet rings for the level just loaded.
+    void DaveGame::createBullets() {
+        for (int i = 0; i < BULLET_POOL_SIZE; ++i) {
+            daveBullets.slots.push_back(createBullet(BULLET, false));
+            monsterBullets.slots.push_back(createBullet(MONSTER_BULLET, true));
+        }
+    }
 
+    /// @brief A parked bullet: kinematic sensor body created disabled, sprite hidden.
+    ent_type DaveGame::createBullet(SDL_FRect sprite, bool fromMonster) {
         b2BodyDef bulletBodyDef = b2DefaultBodyDef();
         bulletBodyDef.type = b2_kinematicBody;
-        bulletBodyDef.position = {center.x / BOX_SCALE, center.y / BOX_SCALE};
+        bulletBodyDef.isEnabled = false;
         b2BodyId bulletBody = b2CreateBody(boxWorld, &bulletBodyDef);
 
         b2ShapeDef bulletShapeDef = b2DefaultShapeDef();
+        bulletShapeDef.filter = collisions.filter(fromMonster ? CollisionClass::MonsterBullet : CollisionClass::Bullet, true);
         bulletShapeDef.enableSensorEvents = true;
         bulletShapeDef.isSensor = true;
 
         b2Polygon bulletBox = b2MakeBox(
-            (BULLET.w / BOX_SCALE) / 2.0f,
-            (BULLET.h / BOX_SCALE) / 2.0f
+            (sprite.w / BOX_SCALE) / 2.0f,
+            (sprite.h / BOX_SCALE) / 2.0f
         );
         b2CreatePolygonShape(bulletBody, &bulletShapeDef, &bulletBox);
 
-        b2Vec2 velocity = { goingLeft ? -bulletSpeed : bulletSpeed, 0.f };
-        b2Body_SetLinearVelocity(bulletBody, velocity);
-
         Entity bullet = Entity::create();
         bullet.addAll(
-            Position{center, 0},
-            Drawable{BULLET, DAVE_TEX_SCALE, true, goingLeft}, // cropped part
+            Position{{0, 0}, 0},
+            PrevPosition{{0, 0}, 0},
+            Drawable{sprite, DAVE_TEX_SCALE, false, false}, // cropped part
             Collider{bulletBody},
-            Bullet{}
+            Collides{fromMonster ? CollisionClass::MonsterBullet : CollisionClass::Bullet},
+            Bullet{},
+            Lifetime{},
+            DespawnBounds{levelBounds}
         );
+        if (fromMonster)
+            bullet.add(Monster{});
 
-        b2Body_SetUserData(bulletBody, new ent_type{bullet.entity()});
+        b2Body_SetUserData(bulletBody, toUserData(bullet.entity()));
+        return bullet.entity();
     }
 
-    void DaveGame::createMonsterBullet(SDL_FPoint monsterPos, bool goingLeft) {
+    /// @brief Launches the next bullet of ring from beside from.
+    void DaveGame::fireBullet(BulletRing& ring, SDL_FPoint from, bool goingLeft) {
 
         constexpr float bulletSpeed = 8.f;
 
+        if (ring.slots.empty())
+            return;
+        const ent_type e = ring.slots[ring.next];
+        ring.next = (ring.next + 1) % ring.slots.size();
+
+        auto& drawable = World::getComponent<Drawable>(e);
         SDL_FPoint center = {
-            monsterPos.x + (goingLeft ? -MONSTER_BULLET.w : MONSTER_BULLET.w),
-            monsterPos.y
+            from.x + (goingLeft ? -drawable.part.w : drawable.part.w),
+            from.y
         };
 
-        b2BodyDef bulletBodyDef = b2DefaultBodyDef();
-        bulletBodyDef.type = b2_kinematicBody;
-        bulletBodyDef.position = {center.x / BOX_SCALE, center.y / BOX_SCALE};
-        b2BodyId bulletBody = b2CreateBody(boxWorld, &bulletBodyDef);
-
-        b2ShapeDef bulletShapeDef = b2DefaultShapeDef();
-        bulletShapeDef.enableSensorEvents = true;
-        bulletShapeDef.isSensor = true;
-
-        b2Polygon bulletBox = b2MakeBox(
-            (MONSTER_BULLET.w / BOX_SCALE) / 2.0f,
-            (MONSTER_BULLET.h / BOX_SCALE) / 2.0f
-        );
-        b2CreatePolygonShape(bulletBody, &bulletShapeDef, &bulletBox);
-
+        const b2BodyId body = World::getComponent<Collider>(e).b;
+        b2Body_SetTransform(body, {center.x / BOX_SCALE, center.y / BOX_SCALE}, b2Rot_identity);
+        b2Body_Enable(body);
         b2Vec2 velocity = { goingLeft ? -bulletSpeed : bulletSpeed, 0.f };
-        b2Body_SetLinearVelocity(bulletBody, velocity);
+        b2Body_SetLinearVelocity(body, velocity);
 
-        Entity bullet = Entity::create();
-        bullet.addAll(
-            Position{center, 0},
-            Drawable{MONSTER_BULLET, DAVE_TEX_SCALE, true, goingLeft}, // cropped part
-            Collider{bulletBody},
-            Bullet{},
-            Monster{}
-        );
+        World::getComponent<Position>(e) = {center, 0};
+        World::getComponent<PrevPosition>(e) = {center, 0};
+        World::getComponent<Lifetime>(e).until = simTime() + BULLET_LIFETIME_MS;
+        drawable.visible = true;
+        drawable.flip = goingLeft;
+    }
 
-        b2Body_SetUserData(bulletBody, new ent_type{bullet.entity()});
+    /// @brief Returns a bullet to its ring; it stops colliding and drawing until fired again.
+    void DaveGame::parkBullet(ent_type e) {
+        b2Body_Disable(World::getComponent<Collider>(e).b);
+        World::getComponent<Drawable>(e).visible = false;
     }
 
 
@@ -1495,7 +1946,9 @@ namespace dave_game{
         .set<Drawable>()
         .build();
         for (id_type id = 0; id <= World::maxId().id; ++id) {
-            ent_type e{id};
+            const ent_type e = World::handle(id);
+            if (!World::alive(e))
+                continue;
             if (World::mask(e).test(statEnt)) {
                 auto& d = World::getComponent<Drawable>(e);
 
@@ -1528,6 +1981,8 @@ namespace dave_game{
         b2BodyId monsterBody = b2CreateBody(boxWorld, &monsterBodyDef);
 
         b2ShapeDef monsterShapeDef = b2DefaultShapeDef();
+
+        monsterShapeDef.filter = collisions.filter(CollisionClass::Monster, false);
         monsterShapeDef.enableSensorEvents = true;
 
         b2Polygon monsterBox = b2MakeBox(
@@ -1550,8 +2005,10 @@ namespace dave_game{
         Entity monster = Entity::create();
         monster.addAll(
             Position{center, 0},
+            PrevPosition{center, 0},
             Drawable{BAT_MONSTER_1, BLOCK_TEX_SCALE, true, false},
             Collider{monsterBody},
+            Collides{CollisionClass::Monster},
             Monster{},
             Animation{batStates, 1, 2, 0, 0, Animation::Type::DAVE},
             CircularMotion{center, 50.0f, 1.5f}
@@ -1562,40 +2019,39 @@ namespace dave_game{
             World::addComponent(monster.entity(), LastShot{});
         }
 
-        b2Body_SetUserData(monsterBody, new ent_type{monster.entity()});
+        b2Body_SetUserData(monsterBody, toUserData(monster.entity()));
     }
 
     ent_type DaveGame::getGunEquipedEntity() {
-        for (int i = 0; i <= World::maxId().id; ++i) {
-            ent_type e{i};
-            if (World::mask(e).test(Component<GunEquipedLabel>::Bit)) {
-                return e;
-            }
+        const View& labels = World::view<GunEquipedLabel>();
+        if (labels.size() > 0) {
+            return labels[0];
         }
 
-        return ent_type{-1};
+        return ent_type{-1, 0};
     }
 
-    void DaveGame::BackAndForthMotionSystem() {
-        static const Mask mask = MaskBuilder()
-            .set<BackAndForthMotion>()
-            .set<Position>()
-            .set<Collider>()
-            .build();
+    /**
+     * @brief Queues an entity and its physics body for removal at the next command playback.
+     */
+    void DaveGame::destroyLater(ent_type e, b2BodyId body) {
+        commands.destroy(e);
+        commands.call([body] { b2DestroyBody(body); });
+        grid.remove(e);
+    }
 
-        for (ent_type e{0}; e.id <= World::maxId().id; ++e.id) {
-            if (World::mask(e).test(mask)) {
-                auto& motion = World::getComponent<BackAndForthMotion>(e);
-                auto& collider = World::getComponent<Collider>(e);
+    void DaveGame::BackAndForthMotionSystem() {
+        World::view<BackAndForthMotion, Position, Collider>().each([](ent_type e) {
+            auto& motion = World::getComponent<BackAndForthMotion>(e);
+            auto& collider = World::getComponent<Collider>(e);
 
-                b2Vec2 velocity = {
-                    motion.direction.x * motion.speed / BOX_SCALE,
-                    motion.direction.y * motion.speed / BOX_SCALE
-                };
+            b2Vec2 velocity = {
+                motion.direction.x * motion.speed / BOX_SCALE,
+                motion.direction.y * motion.speed / BOX_SCALE
+            };
 
-                b2Body_SetLinearVelocity(collider.b, velocity);
-            }
-        }
+            b2Body_SetLinearVelocity(collider.b, velocity);
+        });
     }
 
     void DaveGame::renderMenuOptions() {
@@ -11,18 +11,33 @@
 
 #include "bagel.h"
 #include "box2d/id.h"
+#include "box2d/types.h"
 #include "SDL3/SDL_render.h"
+#include "SDL3/SDL_timer.h"
+#include <array>
+#include <functional>
+#include <initializer_list>
+#include <string>
+#include <unordered_map>
+#include <vector>
 using namespace bagel;
+
+// frameCounter and the animation tables are shared statics, so one game per process
+static_assert(!ThreadLocalWorld, "DaveGame does not support BAGEL_THREAD_LOCAL_WORLD");
+
 namespace dave_game {
     /**
      * @brief Component representing an entity's position on the grid.
      */
-    using Position = struct {SDL_FPoint p; float a;};
+    struct Position {SDL_FPoint p; float a;};
+
+    /// @brief Position before the latest physics step; RenderSystem blends from it toward Position.
+    struct PrevPosition {SDL_FPoint p; float a;};
 
     /**
      * @brief Component representing sprite animation state for rendering.
      */
-    using Drawable = struct {
+    struct Drawable {
         SDL_FRect part;
 
         float scale;
@@ -32,7 +47,7 @@ namespace dave_game {
         bool isStatic = false;
     };
 
-    using Animation = struct {
+    struct Animation {
 
         enum class Type {
             DAVE,
@@ -53,19 +68,19 @@ namespace dave_game {
     /**
      * @brief Component that defines an entity's hitbox size for collision detection.
      */
-    using Collider = struct { b2BodyId b; };
+    struct Collider { b2BodyId b; };
 
 
     /**
      * @brief Component that stores the last input from a player.
      */
-    using Input = struct { SDL_Scancode up, down, right, left; };
+    struct Input { SDL_Scancode up, down, right, left; };
 
 
     /**
      * @brief Component that expresses the current intended action of an entity.
      */
-    using Intent = struct {
+    struct Intent {
         bool up = false, down = false, left = false, right = false;
         bool blockedUp = false, blockedDown = false, blockedLeft = false, blockedRight = false;
     };
@@ -121,6 +136,28 @@ namespace dave_game {
     /// @brief Marks the entity as bullet.
     struct Bullet {};
 
+    /// @brief What an entity is to CollisionSystem; one byte picks its row (as the sensor) or
+    /// column (as the visitor) in the CollisionTable.
+    enum class CollisionClass : uint8_t {
+        None, Dave, Wall, Diamond, Door, Trophy, MoveScreen, Spikes, Monster, Ghost, Gun, Bullet, MonsterBullet,
+        Count
+    };
+
+    /// @brief Collision class of a body's entity, stamped when it is created.
+    struct Collides {
+        CollisionClass as = CollisionClass::None;
+    };
+
+    /// @brief Retires the entity once simTime reaches until (ms).
+    struct Lifetime {
+        uint32_t until = 0;
+    };
+
+    /// @brief Retires the entity once its centre leaves area (pixels).
+    struct DespawnBounds {
+        SDL_FRect area;
+    };
+
     /// @brief Stores global game state: score, lives, and level.
     struct GameInfo {
         int score = 0;
@@ -150,7 +187,10 @@ namespace dave_game {
     };
 
     struct DoorLabel{};
-    struct ScoreLabel{};
+    /// @brief Score digit label; power is the digit's decimal place (0 = ones).
+    struct ScoreLabel {
+        int power = 0;
+    };
     struct LevelLabel{};
     struct GunEquipedLabel{};
 
@@ -158,6 +198,12 @@ namespace dave_game {
         int index;
     };
 
+    /// @brief Never moves or changes look; drawn once into the cached static layer instead of every frame.
+    struct Baked {};
+
+    /// @brief Drawn in screen space on top of the level (status bar values, labels).
+    struct Hud {};
+
     struct MoveScreenSensor {
         bool forward = true;
         int col = 0;
@@ -170,10 +216,187 @@ namespace dave_game {
         float angle = 0.0f;  // current angle
     };
 
+    /// @brief Stands for the Box2D world in the frame schedule; never added to an entity.
+    struct PhysicsWorld {};
+}
 
+/// Position and Collider are swept together by box_system every frame, so keep them packed.
+BAGEL_STORAGE(dave_game::Position, PackedStorage)
+BAGEL_STORAGE(dave_game::Collider, PackedStorage)
+BAGEL_STORAGE(dave_game::PrevPosition, PackedStorage)
 
+namespace dave_game {
 
+    /// @brief Accumulates real time and hands it out as whole simulation steps.
+    /// Backlog beyond maxSteps is dropped, so a slow frame can't snowball.
+    class FixedTimestep {
+    public:
+        FixedTimestep(uint64_t stepNS, int maxSteps) : m_step(stepNS), m_maxSteps(maxSteps) {}
+
+        /// @brief Restarts the clock with nothing owed, e.g. after a level load.
+        void reset() {
+            m_last = SDL_GetTicksNS();
+            m_accumulator = 0;
+        }
+        /// @brief Adds the time since the last call; returns how many steps to simulate now.
+        int advance() {
+            const uint64_t now = SDL_GetTicksNS();
+            m_accumulator += now - m_last;
+            m_last = now;
+            const uint64_t steps = m_accumulator / m_step;
+            m_accumulator -= steps * m_step;
+            return static_cast<int>(std::min<uint64_t>(steps, m_maxSteps));
+        }
+        /// @brief How far the present lies between the last step and the next, in [0,1).
+        float alpha() const { return static_cast<float>(m_accumulator) / m_step; }
+        uint64_t untilNextStep() const { return m_step - m_accumulator; }
+
+    private:
+        uint64_t m_step;
+        int m_maxSteps;
+        uint64_t m_last = 0;
+        uint64_t m_accumulator = 0;
+    };
+
+    /// @brief Per-step key bitsets plus real frame time; replaying one feeds InputSystem exactly
+    /// what the recorded session saw. Saved as "DREC", a step count, then 3 bytes per step.
+    class InputLog {
+    public:
+        /// @brief The keys the game reads during play, in bit order.
+        static constexpr SDL_Scancode KEYS[] = {
+            SDL_SCANCODE_UP, SDL_SCANCODE_DOWN, SDL_SCANCODE_LEFT, SDL_SCANCODE_RIGHT, SDL_SCANCODE_SPACE
+        };
+        struct Step {
+            uint8_t keys;
+            uint16_t frameMs; ///< Real time since the previous step, for reference when profiling
+        };
 
+        void record(const bool* keys, uint16_t frameMs);
+        /// @brief Writes the next recorded step's keys; false once the log is exhausted.
+        bool next(bool* keys);
+        bool save(const std::string& path) const;
+        bool load(const std::string& path);
+        size_t size() const { return m_steps.size(); }
+        bool done() const { return m_cursor == m_steps.size(); }
+
+    private:
+        std::vector<Step> m_steps;
+        size_t m_cursor = 0;
+    };
+
+    /// @brief Collects the frame's quads from one texture atlas and draws them with a single
+    /// SDL_RenderGeometry call, in the order they were added.
+    class SpriteBatch {
+    public:
+        void begin(SDL_Texture* atlas);
+        /// @brief Queues the atlas region src into dst; flip mirrors it horizontally through the UVs.
+        void add(const SDL_FRect& src, const SDL_FRect& dst, bool flip = false);
+        void flush(SDL_Renderer* ren);
+
+    private:
+        SDL_Texture* m_atlas = nullptr;
+        float m_invW = 1.f, m_invH = 1.f;
+        std::vector<SDL_Vertex> m_vertices;
+        std::vector<int> m_indices;
+    };
+
+#ifndef NDEBUG
+    /// @brief Collects b2World_Draw output as 1px line quads and draws them in one call.
+    /// Debug builds only; release frames never query Box2D for it.
+    class PhysicsOverlay {
+    public:
+        PhysicsOverlay();
+        /// @brief Queues the outline of every shape inside view (pixels), scaled by pixelsPerMeter.
+        void draw(b2WorldId world, const SDL_FRect& view, float pixelsPerMeter);
+        void flush(SDL_Renderer* ren);
+
+        bool enabled = false;
+
+    private:
+        static void polygon(const b2Vec2* vertices, int count, b2HexColor color, void* context);
+        static void solidPolygon(b2Transform xf, const b2Vec2* vertices, int count, float radius, b2HexColor color, void* context);
+        static void circle(b2Vec2 center, float radius, b2HexColor color, void* context);
+        static void solidCircle(b2Transform xf, float radius, b2HexColor color, void* context);
+        static void segment(b2Vec2 p1, b2Vec2 p2, b2HexColor color, void* context);
+        void line(b2Vec2 p1, b2Vec2 p2, b2HexColor color);
+
+        b2DebugDraw m_draw;
+        SDL_FPoint m_origin = {0, 0};
+        float m_scale = 1.f;
+        std::vector<SDL_Vertex> m_vertices;
+        std::vector<int> m_indices;
+    };
+#endif
+
+    /// @brief A fixed ring of bullet entities whose bodies are made once per level. Firing takes
+    /// the next slot, recycling it if it is still in flight; a parked bullet keeps its entity
+    /// with its body disabled and its sprite hidden.
+    struct BulletRing {
+        std::vector<ent_type> slots;
+        size_t next = 0;
+    };
+
+    /// @brief Sensor responses by (sensor, visitor) collision class, looked up in one flat table
+    /// instead of testing each entity's tags.
+    class CollisionTable {
+    public:
+        using Handler = std::function<void(ent_type sensor, b2BodyId sensorBody, ent_type visitor, b2BodyId visitorBody)>;
+
+        /// @brief Runs handler when a sensor of class sensor begins touching a visitor of class visitor,
+        /// replacing any earlier handler for that pair.
+        void on(CollisionClass sensor, CollisionClass visitor, Handler handler);
+        void on(CollisionClass sensor, std::initializer_list<CollisionClass> visitors, const Handler& handler);
+        void dispatch(CollisionClass sensorClass, ent_type sensor, b2BodyId sensorBody,
+                      CollisionClass visitorClass, ent_type visitor, b2BodyId visitorBody) const;
+
+        /// @brief Box2D filter for a shape of class c. Sensors only see classes they share a handler
+        /// with, in either role; solid shapes keep colliding with everything.
+        b2Filter filter(CollisionClass c, bool sensor) const;
+
+    private:
+        static constexpr size_t N = static_cast<size_t>(CollisionClass::Count);
+        static size_t index(CollisionClass sensor, CollisionClass visitor) {
+            return static_cast<size_t>(sensor) * N + static_cast<size_t>(visitor);
+        }
+
+        static uint64_t bit(CollisionClass c) { return uint64_t(1) << static_cast<size_t>(c); }
+
+        std::array<Handler, N * N> m_handlers;
+        /// @brief Per class, every class it has a handler with as sensor or as visitor.
+        std::array<uint64_t, N> m_partners{};
+    };
+
+    /// @brief Uniform hash grid over tile coordinates. Each entity is filed under the tile
+    /// holding its centre, so queries should be padded by the largest sprite half-size.
+    class SpatialGrid {
+    public:
+        explicit SpatialGrid(float cellSize) : m_cellSize(cellSize) {}
+
+        /// @brief Files e under the tile holding p, moving it only if that tile or the handle
+        /// filed for its id (a recycled id has a new generation) changed.
+        void move(ent_type e, SDL_FPoint p);
+        /// @brief Drops e, if it is the handle filed for its id.
+        void remove(ent_type e);
+        void clear();
+        /// @brief Appends every entity filed in a tile overlapping rect. Entities may have died
+        /// since they were filed, so callers check World::alive.
+        void query(const SDL_FRect& rect, std::vector<ent_type>& out) const;
+
+    private:
+        using Key = uint64_t;
+        Key key(int cx, int cy) const { return uint64_t(uint32_t(cx)) << 32 | uint32_t(cy); }
+
+        struct Filing {
+            Key key = 0;
+            ent_type e{};
+            bool filed = false;
+        };
+
+        float m_cellSize;
+        std::unordered_map<Key, std::vector<ent_type>> m_cells;
+        /// @brief Tile and handle each entity id is filed under; ids are dense, so a vector beats a map here.
+        std::vector<Filing> m_filing;
+    };
 
     class DaveGame {
 
@@ -184,6 +407,7 @@ namespace dave_game {
         void renderGoThruTheDoor();
 
         void CollisionSystem();
+        void DespawnSystem();
         void RenderSystem();
         void InputSystem();
         void StatusBarSystem();
@@ -191,13 +415,19 @@ namespace dave_game {
         void DeathSystem();
         void AnimationSystem();
         void box_system();
+        void updateGrid();
         void CircularMotionSystem();
         void ShooterSystem();
         void BackAndForthMotionSystem();
         void MenuInputSystem();
 
-        void loadLevel(int level);
-        void unloadLevel();
+        void buildFrame();
+        void buildCollisions();
+        void printTimeline() const;
+        void sampleInput();
+        /// @brief Simulated milliseconds: advances by exactly one step per simulation step.
+        uint32_t simTime() const { return static_cast<uint32_t>(frameCount * 1000LL / FPS); }
+
         void levelAnimation();
         void createMap(uint8_t* map, int width, int height);
 
@@ -210,16 +440,22 @@ namespace dave_game {
         void createDiamond(SDL_FPoint p);
         void createDoor(SDL_FPoint p);
         void createTrophy(SDL_FPoint p);
-        void createSpikes(SDL_FPoint p);
+        void createSpikes(SDL_FPoint p, int count);
         void createMoveScreenSensor(SDL_FPoint p,bool forward, int col);
         void createBlock(SDL_FPoint p,SDL_FRect r);
         void createBatMonster(SDL_FPoint p, bool isGunMonster = false);
         void createGun(SDL_FPoint p);
-        void createBullet(SDL_FPoint davePos, bool goingLeft);
-        void createMonsterBullet(SDL_FPoint monsterPos, bool goingLeft);
+        void createBullets();
+        ent_type createBullet(SDL_FRect sprite, bool fromMonster);
+        void fireBullet(BulletRing& ring, SDL_FPoint from, bool goingLeft);
+        void parkBullet(ent_type e);
 
         ent_type getGunEquipedEntity();
+        void destroyLater(ent_type e, b2BodyId body);
         void renderMenuOptions();
+        void queueSprite(SpriteBatch& batch, ent_type e, SDL_FPoint p, float shiftX) const;
+        void bakeStaticLayer();
+        void clearStaticLayer();
 
         void createStatusBar();
         void createTitles();
@@ -332,10 +568,16 @@ namespace dave_game {
         static constexpr SDL_FRect SCORE_0{ 1961, 842, 60, 68 };
 
         bool skipSensorEvents = false;
+        /// @brief Set once a door or death has been handled during this CollisionSystem run;
+        /// Dave's later events in the same run are skipped.
+        bool leavingLevel = false;
+        CollisionTable collisions;
 
 
         static constexpr uint32_t DAVE_FIRE_COOLDOWN_MS = 1000;
         static constexpr uint32_t MONSTER_FIRE_COOLDOWN_MS = 3500;
+        static constexpr int BULLET_POOL_SIZE = 8;
+        static constexpr uint32_t BULLET_LIFETIME_MS = 4000;
         static constexpr uint32_t DAVE_JUMP_COOLDOWN_MS = 50;
 
 
@@ -345,7 +587,9 @@ namespace dave_game {
         static constexpr int FPS = 60;
         static constexpr float ANIMATION_INTERVAL = 10;
 
-        static constexpr float GAME_FRAME = 1000.f/FPS;
+        static constexpr uint64_t STEP_NS = SDL_NS_PER_SECOND / FPS;
+        /// @brief Most simulation steps a single rendered frame may catch up on.
+        static constexpr int MAX_SUBSTEPS = 5;
         static constexpr float PHYSICS_TIME_STEP = 1.0f / FPS;
         static constexpr float	RAD_TO_DEG = 57.2958f;
 
@@ -395,12 +639,52 @@ namespace dave_game {
 
         static constexpr int SCORE_DIGITS_COUNT = 5;
 
-        SDL_Texture* tex;
-        SDL_Renderer* ren;
-        SDL_Window* win;
+        SDL_Texture* tex = nullptr;
+        SDL_Renderer* ren = nullptr;
+        SDL_Window* win = nullptr;
         GameInfo gameInfo;
+        /// @brief Values the status bar last displayed; StatusBarSystem only redraws what differs.
+        GameInfo shownInfo{-1, -1, -1};
 
         b2WorldId boxWorld = b2_nullWorldId;
+        /// @brief Runs Box2D's solver tasks across all cores.
+        TaskSystem boxTasks;
+        /// @brief Structural changes made while walking sensor events; played back at the end of CollisionSystem.
+        CommandBuffer commands;
+        /// @brief The PLAYING frame: every system with the components it reads and writes.
+        Scheduler frame;
+        /// @brief Set from the DAVE_TIMELINE environment variable; prints each frame's schedule.
+        bool dumpTimeline = false;
+        int frameCount = 0;
+        /// @brief No window, renderer or texture; input comes from setKey instead of the keyboard.
+        bool headless = false;
+        bool scriptedKeys[SDL_SCANCODE_COUNT] = {};
+        /// @brief Keys for the current step, sampled once by sampleInput whatever the source.
+        bool stepKeys[SDL_SCANCODE_COUNT] = {};
+        uint64_t lastStepNS = 0;
+        InputLog recording;
+        InputLog replaying;
+        /// @brief Where recording is saved on exit; empty when not recording.
+        std::string recordPath;
+        /// @brief True when presenting waits for the display, which then paces the main loop.
+        bool vsync = false;
+        /// @brief Fraction of a step since the latest simulation step, used to interpolate rendering.
+        float renderAlpha = 1.f;
+        SpriteBatch sprites;
+        /// @brief Baked level sprites, one render-target texture per screen-width chunk.
+        std::vector<SDL_Texture*> levelChunks;
+        /// @brief Baked status bar titles; drawn without the scroll offset.
+        SDL_Texture* hudLayer = nullptr;
+        BulletRing daveBullets, monsterBullets;
+        /// @brief World-space sprites by tile, kept current by box_system and queried by RenderSystem.
+        SpatialGrid grid{RED_BLOCK.w * BLOCK_TEX_SCALE};
+        /// @brief Extent of the loaded map in pixels, status bar row included.
+        SDL_FRect levelBounds = {0, 0, 0, 0};
+        std::vector<ent_type> visible;
+#ifndef NDEBUG
+        /// @brief Box2D shape outlines over the sprites; F1 toggles it.
+        PhysicsOverlay physicsOverlay;
+#endif
 
         static inline uint8_t walkingMap[5][20] = {
             /* row 0 (sky) */
@@ -685,13 +969,27 @@ namespace dave_game {
             EXIT
         };
 
-        DaveGame();
+        /// @param headless Skip the window and renderer; the game is driven through step() and setKey().
+        explicit DaveGame(bool headless = false);
         ~DaveGame();
 
         bool prepareWindowAndTexture();
 
         void run();
-        bool valid() const { return win != nullptr && ren != nullptr && tex != nullptr; }
+        /// @brief Runs one simulation step: every PLAYING system except presentation.
+        void step();
+        /// @brief Presses or releases a key for InputSystem when headless.
+        void setKey(SDL_Scancode key, bool down) { scriptedKeys[key] = down; }
+        const Scheduler& schedule() const { return frame; }
+        int frames() const { return frameCount; }
+        /// @brief Records every step's input from now on and saves it to path on exit.
+        void recordInput(const std::string& path) { recordPath = path; }
+        /// @brief Takes input from a saved log until it runs out, then from the usual source again.
+        bool replayInput(const std::string& path) { return replaying.load(path); }
+        bool replayDone() const { return replaying.done(); }
+        void loadLevel(int level);
+        void unloadLevel();
+        bool valid() const { return headless || (win != nullptr && ren != nullptr && tex != nullptr); }
 
     private:
         GameState m_gameState = GameState::MENU;
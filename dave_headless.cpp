@@ -0,0 +1,109 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include "dave_game.h"
+using namespace std;
+using namespace dave_game;
+
+namespace
+{
+	// walks right, turns around every 600 frames, jumps every 45 and fires every 30
+	void script(DaveGame& game, int frame) {
+		const bool left = frame / 600 % 2 == 1;
+		game.setKey(SDL_SCANCODE_RIGHT, !left);
+		game.setKey(SDL_SCANCODE_LEFT, left);
+		game.setKey(SDL_SCANCODE_UP, frame % 45 < 3);
+		game.setKey(SDL_SCANCODE_SPACE, frame % 30 == 0);
+	}
+
+	double percentile(vector<double> v, double p) {
+		const size_t i = min(v.size() - 1, static_cast<size_t>(p * v.size()));
+		nth_element(v.begin(), v.begin() + i, v.end());
+		return v[i];
+	}
+
+	// FNV-1a over every Position, so two runs can be checked for identical results
+	uint64_t positionHash() {
+		uint64_t h = 14695981039346656037ull;
+		World::each<Position>([&h](ent_type, const Position& p) {
+			uint32_t bits[3];
+			memcpy(bits, &p, sizeof(bits));
+			for (uint32_t b : bits)
+				h = (h ^ b) * 1099511628211ull;
+		});
+		return h;
+	}
+
+	int liveEntities() {
+		int n = 0;
+		for (id_type id = 0; id <= World::maxId().id; ++id)
+			n += World::alive(World::handle(id));
+		return n;
+	}
+}
+
+// dave_headless [frames] [--record log | --replay log]: steps level 1 with
+// scripted (or replayed) input, no display, as fast as possible, and reports
+// per-system step times. A replay runs until its log ends
+int main(int argc, char** argv)
+{
+	int frames = 10000;
+	string record, replay;
+	for (int i = 1; i < argc; ++i) {
+		const string arg = argv[i];
+		if (arg == "--record" && i + 1 < argc)
+			record = argv[++i];
+		else if (arg == "--replay" && i + 1 < argc)
+			replay = argv[++i];
+		else
+			frames = stoi(arg);
+	}
+
+	DaveGame game(true);
+	if (!record.empty())
+		game.recordInput(record);
+	if (!replay.empty() && !game.replayInput(replay)) {
+		cerr << "Could not read input log " << replay << '\n';
+		return 1;
+	}
+
+	vector<const char*> names;
+	vector<vector<double>> times;
+	vector<double> totals;
+	long long entitySteps = 0;
+	const auto start = chrono::steady_clock::now();
+	for (int f = 0; replay.empty() ? f < frames : !game.replayDone(); ++f) {
+		script(game, f);
+		game.step();
+
+		const auto& timeline = game.schedule().timeline();
+		names.resize(timeline.size());
+		times.resize(timeline.size());
+		double total = 0;
+		for (size_t i = 0; i < timeline.size(); ++i) {
+			names[i] = timeline[i].name;
+			times[i].push_back((timeline[i].end - timeline[i].begin) / 1000.0);
+			total = max(total, timeline[i].end / 1000.0);
+		}
+		totals.push_back(total);
+		entitySteps += liveEntities();
+	}
+	const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	frames = static_cast<int>(totals.size());
+	cout << "\nDaveGame headless, " << frames << " steps\n"
+		 << "system                      p50 us    p99 us\n" << fixed << setprecision(1);
+	for (size_t i = 0; i < names.size(); ++i)
+		cout << left << setw(26) << names[i] << right
+			 << setw(10) << percentile(times[i], 0.5) << setw(10) << percentile(times[i], 0.99) << '\n';
+	cout << left << setw(26) << "step" << right
+		 << setw(10) << percentile(totals, 0.5) << setw(10) << percentile(totals, 0.99) << '\n'
+		 << setprecision(0) << frames / seconds << " steps/s, "
+		 << entitySteps / seconds << " entities/s\n"
+		 << "final state " << hex << positionHash() << '\n';
+	return 0;
+}
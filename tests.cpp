@@ -1,6 +1,8 @@
 #include <iostream>
 #include <cassert>
+#include <string>
 #include "bagel.h"
+#include "dave_game.h"
 using namespace std;
 using namespace bagel;
 
@@ -18,7 +20,148 @@ void test1() {
 	cout << "Test 1 passed\n";
 }
 
+void test2() {
+	ent_type e0 = World::createEntity();
+	[[maybe_unused]] ent_type stale = e0;
+	assert(World::alive(e0) && "New entity is not alive");
+
+	World::destroyEntity(e0);
+	assert(!World::alive(stale) && "Destroyed entity is still alive");
+
+	e0 = World::createEntity();
+	assert(e0.id == stale.id && "Id not recycled after destroy & create");
+	assert(World::alive(e0) && !World::alive(stale) && "Stale handle aliases recycled id");
+
+	World::destroyEntity(e0);
+	cout << "Test 2 passed\n";
+}
+
+struct TestValue { int v; };
+
+void test3() {
+	CommandBuffer cmds;
+	ent_type e0 = World::createEntity();
+	ent_type e1 = cmds.create();
+	cmds.add(e1, TestValue{7});
+	cmds.destroy(e0);
+	cmds.destroy(e0);
+	assert(World::alive(e0) && "Command applied before play");
+
+	cmds.play();
+	assert(!World::alive(e0) && "Deferred destroy not applied");
+	assert(cmds.empty() && "Commands left after play");
+
+	const View& v = World::view<TestValue>();
+	assert(v.size() == 1 && World::getComponent<TestValue>(v[0]).v == 7 && "Deferred create/add not applied");
+
+	World::destroyEntity(v[0]);
+	cout << "Test 3 passed\n";
+}
+
+void test4() {
+	World::step();
+	ent_type e = World::createEntity();
+	World::addComponent(e, TestValue{1});
+	assert(World::sizeAdded() == 1 && World::changed<TestValue>(e) && "Add not logged");
+
+	World::step();
+	assert(World::sizeAdded() == 0 && !World::changed<TestValue>(e) && "Step did not clear changes");
+
+	World::markChanged<TestValue>(e);
+	World::markChanged<TestValue>(e);
+	int visited = 0;
+	World::eachChanged<TestValue>([&](ent_type) { ++visited; });
+	assert(World::sizeChanged() == 1 && visited == 1 && "Change not logged once");
+
+	World::destroyEntity(e);
+	assert(World::sizeRemoved() == 1 && "Destroy not logged as removal");
+	World::step();
+	cout << "Test 4 passed\n";
+}
+
+void test5() {
+	using namespace dave_game;
+	DaveGame game(true);
+	assert(game.valid() && "Game failed to start");
+	assert(PackedStorage<Position>::size() > 0 && "Level created no packed components");
+
+	game.unloadLevel();
+	assert(PackedStorage<Position>::size() == 0 && "Position entries left after unloadLevel");
+	assert(PackedStorage<Collider>::size() == 0 && "Collider entries left after unloadLevel");
+
+	game.loadLevel(1);
+	game.unloadLevel();
+	assert(PackedStorage<Position>::size() == 0 && "Position entries left after reload");
+	cout << "Test 5 passed\n";
+}
+
+struct TestTag {};
+
+void test6() {
+	ent_type a = World::createEntity();
+	ent_type b = World::createEntity();
+	World::addComponents(a, TestValue{1}, TestTag{});
+	World::addComponent(b, TestValue{2});
+
+	vector<ent_type> out;
+	World::match(MaskBuilder().set<TestValue>().set<TestTag>().build(), out);
+	assert(out.size() == 1 && out[0] == a && "Match returned wrong entities");
+
+	World::destroyEntity(a);
+	out.clear();
+	World::match(MaskBuilder().set<TestValue>().build(), out);
+	assert(out.size() == 1 && out[0] == b && "Match returned a destroyed entity");
+
+	World::destroyEntity(b);
+	cout << "Test 6 passed\n";
+}
+
+void test7() {
+	DynamicBag<string, 2> names;
+	for (int i = 0; i < 100; ++i)
+		names.push(to_string(i));
+	names.ensure(200);
+	assert(names[99] == "99" && names[150].empty() && "Non-trivial bag lost elements on growth");
+
+	DynamicBag<int, 16, VirtualAllocator> ints;
+	ints.push(42);
+	[[maybe_unused]] const int* first = &ints[0];
+	for (int i = 0; i < 100000; ++i)
+		ints.push(i);
+	assert(&ints[0] == first && ints[0] == 42 && "Virtual bag moved on growth");
+
+	cout << "Test 7 passed\n";
+}
+
+void test8() {
+	struct A {};
+	struct B {};
+	vector<string> order;
+	mutex m;
+	const auto log = [&](const char* name) { lock_guard lock(m); order.push_back(name); };
+
+	Scheduler s;
+	s.add("readB", [&] { log("readB"); }).reads<B>();
+	s.add("writeA", [&] { log("writeA"); }).writes<A>();
+	s.add("readA", [&] { log("readA"); }).reads<A>().writes<B>();
+	s.add("last", [&] { log("last"); }).exclusive();
+	s.run();
+
+	[[maybe_unused]] const auto at = [&](const char* name) { return find(order.begin(), order.end(), name) - order.begin(); };
+	assert(order.size() == 4 && "Scheduler skipped a system");
+	assert(at("writeA") < at("readA") && at("readB") < at("readA") && "Scheduler broke a dependency");
+	assert(order.back() == "last" && s.timeline()[3].critical && "Exclusive system did not run last");
+	cout << "Test 8 passed\n";
+}
+
 void run_tests()
 {
 	test1();
+	test2();
+	test3();
+	test4();
+	test5();
+	test6();
+	test7();
+	test8();
 }
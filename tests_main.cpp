@@ -0,0 +1,6 @@
+// runs the asserts in tests.cpp; CMake builds this without NDEBUG so they stay active
+void run_tests();
+
+int main() {
+	run_tests();
+}